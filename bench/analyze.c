@@ -0,0 +1,281 @@
+/**
+ * Runs a raw MIDI file through the encoder as if it came in on the UART back to back, flushing at every connection
+ * event, then decodes the notifications and scores them against the input:
+ *   analyze [-m mtu] [-x bytes] [-c] [-l] [-i conn interval us] [-s seed] [-w recording] [-r recording]
+ *           [-a seeds] {-g corpus | input.mid}
+ * The UART hands over random chunks of up to BLE_MIDI_UART_CHUNK bytes, -l hands over every message as soon as it is
+ * complete like UART_INGESTION_LOW_LATENCY does, SysEx in LOW_LATENCY_CHUNK blocks. -x starts at the default MTU of 23
+ * and changes to -m once this many input bytes went in, as an MTU exchange during playing would. -w keeps the
+ * notifications, -r scores a recording instead of running the encoder. A recording is a length, 16 bit little endian,
+ * then the payload, for every notification. -g generates the input with one of codec_bench's corpora, seeded with -s.
+ * -a sweeps seeds 1 to this many against every MTU in sweep_mtus and both modes, with one line for every run.
+ * Exits with 1 if the notifications do not carry the input.
+ * Running the encoder also reports its latency, from UART arrival until the notification, on the simulated clock, and
+ * why its packets were closed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "analyzer.h"
+#include "ble_midi.h"
+#include "corpus.h"
+#include "processor.h"
+#include "time_source.h"
+
+#define BYTE_US 320
+#define MTU_DEFAULT 23
+#define MTU_MAX 517
+#define LOW_LATENCY_CHUNK 32 // UART_INGESTION_LOW_LATENCY.rx_full_threshold
+#define GENERATED_SIZE (64 * 1024)
+
+static const uint16_t sweep_mtus[] = {23, 64, 100, 185, 247, 517};
+
+static struct analyzer_t analyzer;
+static FILE *recording;
+static struct processor_latency_t latency;
+static struct processor_counters_t counters;
+static struct mock_time_source_t simulated_time;
+
+static bool record_sink(uint8_t *packet, uint16_t len, void *context) {
+    (void) context;
+    if (recording) {
+        const uint8_t len_bytes[2] = {len & 0xFF, len >> 8};
+        fwrite(len_bytes, 1, sizeof(len_bytes), recording);
+        fwrite(packet, 1, len, recording);
+    }
+    analyzer_packet(packet, len, &analyzer);
+    return true;
+}
+
+static int64_t simulated_clock(void *context) {
+    return time_source_now_us(context);
+}
+
+static void print_latency(const char *stage, const struct latency_histogram_t *histogram) {
+    printf("%-19s %10u %8uus p50 %8uus p99 %8uus p99.9 %8uus max\n", stage, histogram->count,
+           latency_percentile(histogram, 500), latency_percentile(histogram, 990), latency_percentile(histogram, 999),
+           histogram->max_us);
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *buff = malloc(*len ? *len : 1);
+    if (buff && fread(buff, 1, *len, file) != *len) {
+        free(buff);
+        buff = NULL;
+    }
+    fclose(file);
+    return buff;
+}
+
+static void encode(const uint8_t *input, const int64_t *arrival_us, size_t len, uint16_t mtu, size_t exchange_at,
+                   processor_mode mode, bool low_latency, uint32_t conn_interval_us) {
+    struct processor_t processor = {0};
+    int64_t conn_event_us = conn_interval_us;
+
+    init_processor(&processor, (exchange_at ? MTU_DEFAULT : mtu) - 3, mode, record_sink, NULL);
+    init_mock_time_source(&simulated_time, 0);
+    processor.clock = simulated_clock;
+    processor.clock_context = &simulated_time.time_source;
+    processor.latency = &latency;
+    processor.counters = &counters;
+    for (size_t i = 0; i < len;) {
+        if (exchange_at && i >= exchange_at) {
+            processor_set_buff_max(&processor, mtu - 3);
+            exchange_at = 0;
+        }
+        const uint8_t remaining = processor_message_remaining(&processor);
+        size_t chunk = !low_latency ? 1 + rand() % BLE_MIDI_UART_CHUNK : remaining ? remaining : LOW_LATENCY_CHUNK;
+        if (chunk > len - i) chunk = len - i;
+        const int64_t end_us = arrival_us[i + chunk - 1];
+
+        while (conn_event_us <= end_us) {
+            mock_time_source_advance(&simulated_time, conn_event_us - simulated_time.now_us);
+            flush_notify(&processor);
+            conn_event_us += conn_interval_us;
+        }
+        mock_time_source_advance(&simulated_time, end_us - simulated_time.now_us);
+        processor_process_buffer(input + i, chunk, end_us, BYTE_US, &processor);
+        processor_drain(&processor);
+        i += chunk;
+    }
+    mock_time_source_advance(&simulated_time, conn_event_us - simulated_time.now_us);
+    flush_notify(&processor);
+}
+
+static bool replay(const char *path) {
+    size_t len;
+    uint8_t *buff = read_file(path, &len);
+    if (!buff) return false;
+
+    size_t i = 0;
+    while (i + 2 <= len) {
+        const uint16_t packet_len = buff[i] | buff[i + 1] << 8;
+        if (i + 2 + packet_len > len) break;
+        analyzer_packet(buff + i + 2, packet_len, &analyzer);
+        i += 2 + packet_len;
+    }
+    free(buff);
+    return i == len;
+}
+
+/** Seeds the generator and fills input with a fresh corpus, or leaves the file's content where it is */
+static size_t prepare(uint8_t *input, size_t len, corpus_generator_t generator, unsigned int seed,
+                      int64_t *arrival_us) {
+    if (generator) {
+        corpus_seed(seed);
+        len = generator(input, GENERATED_SIZE);
+    }
+    for (size_t i = 0; i < len; i++) arrival_us[i] = (int64_t) (i + 1) * BYTE_US;
+    return len;
+}
+
+static bool sweep(uint8_t *input, size_t len, corpus_generator_t generator, unsigned int seeds, size_t exchange_at,
+                  bool low_latency, uint32_t conn_interval_us, int64_t *arrival_us) {
+    static const processor_mode modes[] = {PROCESSOR_MODE_DEFAULT, PROCESSOR_MODE_COMPACT};
+    uint32_t inexact = 0;
+    uint32_t runs = 0;
+
+    printf("%6s %6s %8s %10s %10s %10s %10s\n", "seed", "mtu", "mode", "malformed", "mismatched", "missing",
+           "unexpected");
+    for (unsigned int seed = 1; seed <= seeds; seed++) {
+        len = prepare(input, len, generator, seed, arrival_us);
+        for (size_t m = 0; m < sizeof(sweep_mtus) / sizeof(sweep_mtus[0]); m++) {
+            for (size_t c = 0; c < sizeof(modes) / sizeof(modes[0]); c++) {
+                if (!init_analyzer(&analyzer, input, arrival_us, len)) {
+                    fprintf(stderr, "out of memory\n");
+                    exit(2);
+                }
+                memset(&latency, 0, sizeof(latency));
+                memset(&counters, 0, sizeof(counters));
+                srand(seed);
+                encode(input, arrival_us, len, sweep_mtus[m], exchange_at, modes[c], low_latency, conn_interval_us);
+                const bool exact = analyzer_exact(&analyzer);
+                printf("%6u %6u %8s %10u %10llu %10llu %10llu%s\n", seed, sweep_mtus[m],
+                       modes[c] == PROCESSOR_MODE_COMPACT ? "compact" : "default", analyzer.malformed,
+                       (unsigned long long) analyzer.mismatched, (unsigned long long) analyzer.missing,
+                       (unsigned long long) analyzer.unexpected, exact ? "" : "  inexact");
+                free_analyzer(&analyzer);
+                inexact += !exact;
+                runs++;
+            }
+        }
+    }
+    printf("%u of %u runs inexact\n", inexact, runs);
+    return !inexact;
+}
+
+int main(int argc, char **argv) {
+    uint16_t mtu = 247;
+    processor_mode mode = PROCESSOR_MODE_DEFAULT;
+    bool low_latency = false;
+    size_t exchange_at = 0;
+    uint32_t conn_interval_us = 7500;
+    unsigned int seed = 1;
+    unsigned int seeds = 0;
+    corpus_generator_t generator = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:x:cli:s:w:r:a:g:")) != -1) {
+        switch (opt) {
+            case 'm':
+                mtu = atoi(optarg);
+                break;
+            case 'x':
+                exchange_at = atol(optarg);
+                break;
+            case 'c':
+                mode = PROCESSOR_MODE_COMPACT;
+                break;
+            case 'l':
+                low_latency = true;
+                break;
+            case 'i':
+                conn_interval_us = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'w':
+                record_path = optarg;
+                break;
+            case 'r':
+                replay_path = optarg;
+                break;
+            case 'a':
+                seeds = atoi(optarg);
+                break;
+            case 'g':
+                if (!(generator = corpus_find(optarg))) optind = argc;
+                break;
+            default:
+                optind = argc;
+        }
+    }
+    if (optind != argc - !generator || mtu < 23 || mtu > MTU_MAX || !conn_interval_us) {
+        fprintf(stderr, "usage: %s [-m mtu] [-x bytes] [-c] [-l] [-i conn interval us] [-s seed] [-w recording] "
+                        "[-r recording] [-a seeds] {-g corpus | input.mid}\ncorpora:", argv[0]);
+        for (size_t i = 0; i < corpus_kind_count; i++) fprintf(stderr, " %s", corpus_kinds[i].name);
+        fprintf(stderr, "\n");
+        return 2;
+    }
+
+    size_t len = GENERATED_SIZE;
+    uint8_t *input = generator ? malloc(GENERATED_SIZE) : read_file(argv[optind], &len);
+    int64_t *arrival_us = malloc((len ? len : 1) * sizeof(int64_t));
+    if (!input || !arrival_us) {
+        fprintf(stderr, "cannot read %s\n", generator ? "the corpus" : argv[optind]);
+        return 2;
+    }
+
+    if (seeds) {
+        const bool exact = sweep(input, len, generator, seeds, exchange_at, low_latency, conn_interval_us, arrival_us);
+        free(arrival_us);
+        free(input);
+        return exact ? 0 : 1;
+    }
+
+    len = prepare(input, len, generator, seed, arrival_us);
+    if (!init_analyzer(&analyzer, input, arrival_us, len)) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+
+    if (replay_path) {
+        if (!replay(replay_path)) {
+            fprintf(stderr, "cannot read %s, or it ends inside a notification\n", replay_path);
+            return 2;
+        }
+    } else {
+        if (record_path && !(recording = fopen(record_path, "wb"))) {
+            fprintf(stderr, "cannot write %s\n", record_path);
+            return 2;
+        }
+        srand(seed);
+        encode(input, arrival_us, len, mtu, exchange_at, mode, low_latency, conn_interval_us);
+        if (recording) fclose(recording);
+    }
+
+    const bool exact = analyzer_report(&analyzer, stdout);
+    if (!replay_path) {
+        print_latency("latency buff", &latency.buff);
+        print_latency("latency flush", &latency.flush);
+        print_latency("latency ring", &latency.ring);
+        print_latency("latency total", &latency.total);
+        printf("packets closed      %10u full, %u urgent, %u gap, %u flush\n", counters.closes[PROCESSOR_CLOSE_FULL],
+               counters.closes[PROCESSOR_CLOSE_URGENT], counters.closes[PROCESSOR_CLOSE_GAP],
+               counters.closes[PROCESSOR_CLOSE_FLUSH]);
+    }
+    free_analyzer(&analyzer);
+    free(arrival_us);
+    free(input);
+    return exact ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyzer.h"
+#include "ble_midi.h"
+
+// a message missing from the notifications is skipped over if the decoded one turns up this close behind it
+#define RESYNC_WINDOW 16
+
+/** Clock, tick and active sensing, start, continue and stop keep their place among the other messages */
+static inline struct analyzer_queue_t *queue_of(uint8_t status, struct analyzer_t *analyzer) {
+    return status >= 0xF8 && (status < 0xFA || status > 0xFC) ? &analyzer->realtime : &analyzer->other;
+}
+
+static void expect(struct analyzer_queue_t *queue, const uint8_t *bytes, uint8_t len, bool timed, int64_t arrival_us) {
+    struct analyzer_message_t *message = &queue->messages[queue->count++];
+    memcpy(message->bytes, bytes, len);
+    message->len = len;
+    message->timed = timed;
+    message->arrival_us = arrival_us;
+}
+
+static void score(struct analyzer_t *analyzer, uint16_t timestamp, int64_t arrival_us) {
+    const int64_t arrival_ms = arrival_us / 1000;
+    int64_t delta_ms = (timestamp - arrival_ms) & BLE_MIDI_TIMESTAMP_MASK;
+    if (delta_ms > BLE_MIDI_TIMESTAMP_MASK / 2) delta_ms -= BLE_MIDI_TIMESTAMP_MASK + 1;
+    const int64_t error_us = (arrival_ms + delta_ms) * 1000 - arrival_us;
+
+    if (!analyzer->timed || error_us < analyzer->error_min_us) analyzer->error_min_us = error_us;
+    if (!analyzer->timed || error_us > analyzer->error_max_us) analyzer->error_max_us = error_us;
+    analyzer->timed++;
+    analyzer->error_sum_us += error_us;
+
+    // floor, so [-1ms, 0) is its own bucket
+    int64_t bucket = (error_us >= 0 ? error_us / 1000 : (error_us - 999) / 1000) + ANALYZER_ERROR_RANGE_MS + 1;
+    if (bucket < 0) bucket = 0;
+    if (bucket > 2 * ANALYZER_ERROR_RANGE_MS + 1) bucket = 2 * ANALYZER_ERROR_RANGE_MS + 1;
+    analyzer->error_ms[bucket]++;
+}
+
+static bool same(const struct analyzer_message_t *message, const uint8_t *bytes, uint16_t len) {
+    return message->len == len && memcmp(message->bytes, bytes, len) == 0;
+}
+
+static void match(struct analyzer_t *analyzer, struct analyzer_queue_t *queue, const uint8_t *bytes, uint16_t len,
+                  uint16_t timestamp) {
+    if (queue->next == queue->count) {
+        analyzer->unexpected++;
+        return;
+    }
+
+    size_t next = queue->next;
+    while (next < queue->count && next - queue->next < RESYNC_WINDOW && !same(&queue->messages[next], bytes, len)) {
+        next++;
+    }
+    if (next == queue->count || next - queue->next == RESYNC_WINDOW) {
+        analyzer->mismatched++;
+        queue->next++;
+        return;
+    }
+
+    analyzer->missing += next - queue->next;
+    queue->next = next + 1;
+    if (queue->messages[next].timed) score(analyzer, timestamp, queue->messages[next].arrival_us);
+}
+
+static void received(struct analyzer_t *analyzer, const uint8_t *bytes, uint8_t len, uint16_t timestamp) {
+    analyzer->midi_bytes += len;
+    if (bytes[0] < 0x80) {
+        match(analyzer, &analyzer->other, bytes, 1, timestamp);
+        return;
+    }
+
+    analyzer->messages++;
+    analyzer->packet_messages++;
+    match(analyzer, queue_of(bytes[0], analyzer), bytes, len, timestamp);
+}
+
+/** Data bytes following a status byte, -1 for the ones that start no message of their own */
+static int8_t data_len_of(uint8_t status) {
+    if (status < 0xF0) return (status & 0xE0) == 0xC0 ? 1 : 2;
+    switch (status) {
+        case 0xF1:
+        case 0xF3:
+            return 1;
+        case 0xF2:
+            return 2;
+        case 0xF6:
+            return 0;
+        default:
+            return status >= 0xF8 ? 0 : -1;
+    }
+}
+
+/**
+ * One notification read the way the BLE-MIDI specification lays it out, kept apart from decoder_decode so that a
+ * mistake the encoder and the shipped decoder share cannot pass as exact: a header with the timestamp's high bits,
+ * every status byte behind a timestamp byte, data under running status with or without one, real-time anywhere,
+ * SysEx data without timestamp bytes up to a timestamped 0xF7, carrying over into the next notification. System
+ * common and SysEx cancel running status, real-time does not. Returns false at the first byte that breaks the format.
+ */
+static bool decode(const uint8_t *packet, uint16_t len, struct analyzer_t *analyzer) {
+    uint16_t high;
+    uint8_t low = 0;
+    uint16_t timestamp = 0;
+    uint8_t status = 0; // running status, it only holds within a notification
+    uint8_t message[3];
+    uint8_t message_len = 0;
+    int8_t data_len = 0;
+    bool stamped = false; // the last byte was a timestamp byte
+
+    if (len < 2 || (packet[0] & 0xC0) != 0x80) return false;
+    high = packet[0] & 0x3F;
+
+    for (uint16_t i = 1; i < len; i++) {
+        const uint8_t byte = packet[i];
+
+        if (byte & 0x80 && !stamped) {
+            // a timestamp byte may not cut a message short, a smaller low byte than the last one carries
+            if (message_len) return false;
+            if ((byte & 0x7F) < low) high++;
+            low = byte & 0x7F;
+            timestamp = ((high << 7) | low) & BLE_MIDI_TIMESTAMP_MASK;
+            stamped = true;
+            continue;
+        }
+
+        if (byte & 0x80) {
+            stamped = false;
+            if (byte >= 0xF8) {
+                received(analyzer, &byte, 1, timestamp);
+            } else if (analyzer->sys_ex) {
+                if (byte != 0xF7) return false;
+                analyzer->sys_ex = false;
+                status = 0;
+                received(analyzer, &byte, 1, timestamp);
+            } else if (byte == 0xF0) {
+                analyzer->sys_ex = true;
+                analyzer->sys_ex_timestamp = timestamp;
+                status = 0;
+                received(analyzer, &byte, 1, timestamp);
+            } else {
+                if ((data_len = data_len_of(byte)) < 0) return false;
+                status = byte;
+                message[message_len++] = byte;
+                if (!data_len) {
+                    received(analyzer, message, 1, timestamp);
+                    message_len = 0;
+                    status = 0;
+                }
+            }
+            continue;
+        }
+
+        if (analyzer->sys_ex) {
+            // SysEx data goes on without timestamp bytes
+            if (stamped) return false;
+            received(analyzer, &byte, 1, analyzer->sys_ex_timestamp);
+            continue;
+        }
+        stamped = false;
+        if (!message_len) {
+            if (!status) return false;
+            message[message_len++] = status;
+        }
+        message[message_len++] = byte;
+        if (message_len == data_len + 1) {
+            received(analyzer, message, message_len, timestamp);
+            message_len = 0;
+            if (status >= 0xF0) status = 0;
+        }
+    }
+    return !stamped && !message_len;
+}
+
+bool init_analyzer(struct analyzer_t *analyzer, const uint8_t *input, const int64_t *arrival_us, size_t len) {
+    uint8_t running = 0;
+    uint8_t message[3];
+    uint8_t message_len = 0;
+    int8_t data_len = 0;
+    int64_t message_us = 0;
+    bool sys_ex = false;
+    bool sys_ex_started = false;
+    const uint8_t sys_ex_start = 0xF0;
+    const uint8_t eox = 0xF7;
+
+    memset(analyzer, 0, sizeof(struct analyzer_t));
+    analyzer->realtime.messages = malloc(len * sizeof(struct analyzer_message_t));
+    // an interrupted SysEx adds an 0xF7 the input does not have
+    analyzer->other.messages = malloc(2 * len * sizeof(struct analyzer_message_t));
+    if (len && (!analyzer->realtime.messages || !analyzer->other.messages)) {
+        free_analyzer(analyzer);
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t byte = input[i];
+
+        if (byte >= 0xF8) {
+            expect(queue_of(byte, analyzer), &byte, 1, true, arrival_us[i]);
+            continue;
+        }
+
+        if (byte & 0x80) {
+            const bool undefined = byte == 0xF4 || byte == 0xF5;
+            if (sys_ex && !sys_ex_started) {
+                // with no data yet an 0xF7 makes an empty SysEx, undefined bytes are skipped, any other status
+                // byte drops the 0xF0
+                if (undefined) continue;
+                sys_ex = false;
+                if (byte == 0xF7) {
+                    expect(&analyzer->other, &sys_ex_start, 1, true, message_us);
+                    expect(&analyzer->other, &eox, 1, true, arrival_us[i]);
+                    continue;
+                }
+            } else if (sys_ex) {
+                // the encoder ends SysEx with its own 0xF7 when another status byte cuts it short
+                sys_ex = false;
+                expect(&analyzer->other, &eox, 1, true, arrival_us[i]);
+                if (byte == 0xF7) continue;
+            }
+            // undefined and stray EOX bytes are ignored, the message they landed in goes on
+            if (undefined || byte == 0xF7) continue;
+            message_len = 0;
+            switch (byte) {
+                case 0xF0:
+                    // like any other message it is complete, and in order with real-time bytes, once data follows
+                    sys_ex = true;
+                    sys_ex_started = false;
+                    running = 0;
+                    message_us = arrival_us[i];
+                    break;
+                case 0xF6:
+                    running = 0;
+                    expect(&analyzer->other, &byte, 1, true, arrival_us[i]);
+                    break;
+                default:
+                    running = byte;
+                    data_len = data_len_of(byte);
+                    message[message_len++] = byte;
+                    message_us = arrival_us[i];
+            }
+            continue;
+        }
+
+        if (sys_ex) {
+            if (!sys_ex_started) expect(&analyzer->other, &sys_ex_start, 1, true, message_us);
+            sys_ex_started = true;
+            expect(&analyzer->other, &byte, 1, false, arrival_us[i]);
+            continue;
+        }
+        if (!running) continue;
+
+        if (!message_len) {
+            message[message_len++] = running;
+            message_us = arrival_us[i];
+        }
+        message[message_len++] = byte;
+        if (message_len == data_len + 1) {
+            expect(&analyzer->other, message, message_len, true, message_us);
+            message_len = 0;
+            // system common has no running status
+            if (running >= 0xF0) running = 0;
+        }
+    }
+    return true;
+}
+
+void free_analyzer(struct analyzer_t *analyzer) {
+    free(analyzer->realtime.messages);
+    free(analyzer->other.messages);
+    analyzer->realtime.messages = NULL;
+    analyzer->other.messages = NULL;
+}
+
+void analyzer_packet(const uint8_t *packet, uint16_t len, struct analyzer_t *analyzer) {
+    analyzer->packets++;
+    analyzer->packet_bytes += len;
+    analyzer->packet_messages = 0;
+
+    if (!decode(packet, len, analyzer)) {
+        analyzer->sys_ex = false;
+        if (analyzer->malformed < ANALYZER_MALFORMED_REPORTED) {
+            analyzer->malformed_packets[analyzer->malformed] = analyzer->packets - 1;
+        }
+        analyzer->malformed++;
+    }
+
+    const uint32_t bucket = analyzer->packet_messages < ANALYZER_MESSAGES_MAX ? analyzer->packet_messages
+                                                                              : ANALYZER_MESSAGES_MAX;
+    analyzer->messages_per_packet[bucket]++;
+}
+
+bool analyzer_exact(struct analyzer_t *analyzer) {
+    analyzer->missing += analyzer->realtime.count - analyzer->realtime.next;
+    analyzer->missing += analyzer->other.count - analyzer->other.next;
+    analyzer->realtime.next = analyzer->realtime.count;
+    analyzer->other.next = analyzer->other.count;
+    return !analyzer->malformed && !analyzer->mismatched && !analyzer->missing && !analyzer->unexpected;
+}
+
+bool analyzer_report(struct analyzer_t *analyzer, FILE *out) {
+    const uint32_t malformed = analyzer->malformed;
+    const bool exact = analyzer_exact(analyzer);
+
+    fprintf(out, "packets             %10llu\n", (unsigned long long) analyzer->packets);
+    fprintf(out, "notification bytes  %10llu\n", (unsigned long long) analyzer->packet_bytes);
+    fprintf(out, "MIDI bytes          %10llu\n", (unsigned long long) analyzer->midi_bytes);
+    fprintf(out, "efficiency          %10.3f MIDI bytes per notification byte\n",
+            analyzer->packet_bytes ? (double) analyzer->midi_bytes / analyzer->packet_bytes : 0);
+    fprintf(out, "messages per packet %10.2f\n",
+            analyzer->packets ? (double) analyzer->messages / analyzer->packets : 0);
+    for (uint32_t i = 0; i <= ANALYZER_MESSAGES_MAX; i++) {
+        if (!analyzer->messages_per_packet[i]) continue;
+        fprintf(out, "  %4u%s %12llu\n", i, i == ANALYZER_MESSAGES_MAX ? "+" : " ",
+                (unsigned long long) analyzer->messages_per_packet[i]);
+    }
+
+    fprintf(out, "timestamp error     %10.1fus mean, %lldus min, %lldus max, %llu messages\n",
+            analyzer->timed ? (double) analyzer->error_sum_us / analyzer->timed : 0,
+            (long long) analyzer->error_min_us, (long long) analyzer->error_max_us,
+            (unsigned long long) analyzer->timed);
+    for (int32_t i = 0; i < 2 * ANALYZER_ERROR_RANGE_MS + 2; i++) {
+        if (!analyzer->error_ms[i]) continue;
+        if (i == 0) {
+            fprintf(out, "      < %3dms %12llu\n", -ANALYZER_ERROR_RANGE_MS,
+                    (unsigned long long) analyzer->error_ms[i]);
+        } else if (i == 2 * ANALYZER_ERROR_RANGE_MS + 1) {
+            fprintf(out, "     >= %3dms %12llu\n", ANALYZER_ERROR_RANGE_MS,
+                    (unsigned long long) analyzer->error_ms[i]);
+        } else {
+            fprintf(out, "  [%3d, %3d)ms %11llu\n", i - ANALYZER_ERROR_RANGE_MS - 1, i - ANALYZER_ERROR_RANGE_MS,
+                    (unsigned long long) analyzer->error_ms[i]);
+        }
+    }
+
+    fprintf(out, "malformed packets   %10u", malformed);
+    for (uint32_t i = 0; i < malformed && i < ANALYZER_MALFORMED_REPORTED; i++) {
+        fprintf(out, "%s%llu", i ? ", " : " (", (unsigned long long) analyzer->malformed_packets[i]);
+    }
+    fprintf(out, "%s\n", !malformed ? "" : malformed > ANALYZER_MALFORMED_REPORTED ? ", ...)" : ")");
+    fprintf(out, "mismatched messages %10llu\n", (unsigned long long) analyzer->mismatched);
+    fprintf(out, "missing messages    %10llu\n", (unsigned long long) analyzer->missing);
+    fprintf(out, "unexpected messages %10llu\n", (unsigned long long) analyzer->unexpected);
+
+    return exact;
+}
@@ -0,0 +1,65 @@
+/** Scores recorded BLE-MIDI notifications against the MIDI stream the encoder was given */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ANALYZER_MESSAGES_MAX 32 // messages per packet histogram, the last bucket takes everything above
+
+#define ANALYZER_ERROR_RANGE_MS 8 // timestamp error histogram in 1ms buckets, beyond this on both sides counts as out
+
+#define ANALYZER_MALFORMED_REPORTED 10
+
+/** A message as decoded from the notifications: status included, SysEx one byte at a time */
+struct analyzer_message_t {
+    uint8_t bytes[3];
+    uint8_t len;
+    bool timed; // SysEx data carries the timestamp of its 0xF0, there is nothing to score
+    int64_t arrival_us; // of the message's first byte
+};
+
+struct analyzer_queue_t {
+    struct analyzer_message_t *messages;
+    size_t count;
+    size_t next;
+};
+
+struct analyzer_t {
+    bool sys_ex; // a SysEx message continues into the next notification
+    uint16_t sys_ex_timestamp;
+    // clock, tick and active sensing may overtake the others, each kind is matched in order on its own
+    struct analyzer_queue_t realtime;
+    struct analyzer_queue_t other;
+
+    uint64_t packets;
+    uint64_t packet_bytes;
+    uint64_t midi_bytes;
+    uint64_t messages;
+    uint64_t mismatched;
+    uint64_t missing; // in the input, not in the notifications
+    uint64_t unexpected; // decoded past the end of the input
+    uint32_t packet_messages; // of the packet being decoded
+    uint64_t messages_per_packet[ANALYZER_MESSAGES_MAX + 1];
+    uint32_t malformed; // notifications dropped from the first byte that does not fit the format
+    uint64_t malformed_packets[ANALYZER_MALFORMED_REPORTED];
+
+    uint64_t timed;
+    int64_t error_sum_us;
+    int64_t error_min_us;
+    int64_t error_max_us;
+    uint64_t error_ms[2 * ANALYZER_ERROR_RANGE_MS + 2]; // below the range, one per ms, above the range
+};
+
+/** Parses the UART input the way the encoder does, arrival_us holds the arrival time of every input byte */
+bool init_analyzer(struct analyzer_t *analyzer, const uint8_t *input, const int64_t *arrival_us, size_t len);
+
+void free_analyzer(struct analyzer_t *analyzer);
+
+void analyzer_packet(const uint8_t *packet, uint16_t len, struct analyzer_t *analyzer);
+
+/** Counts what the notifications never got to as missing, returns false if they do not carry the input exactly */
+bool analyzer_exact(struct analyzer_t *analyzer);
+
+/** Prints the report, returns false if the notifications do not carry the input exactly */
+bool analyzer_report(struct analyzer_t *analyzer, FILE *out);
@@ -1,17 +1,41 @@
+/*
+ * The encoder as it was before the transition table, kept for codec_bench to compare against. Only ble_notify and the
+ * logging gave way to a sink, and the names to ones that do not clash with the codec. Its bugs are kept as well: it
+ * drops real-time bytes, and waits for a second data byte under running status of one-byte messages.
+ */
 #include <stdlib.h>
 #include <string.h>
 
-#include "esp_log.h"
+#include "baseline_processor.h"
 
-#include "ble.h"
-#include "processor.h"
+typedef enum {
+    STATUS_NOTE_OFF_PREF_4 = 0x8, // 2 data bytes
+    STATUS_NOTE_ON_PREF_4, // 2 data bytes
+    STATUS_PKP_AFTERTOUCH_PREF_4, // 2 data bytes
+    STATUS_CC_PREF_4, // 2 data bytes
+    STATUS_PROGRAM_CHANGE_PREF_4, // 1 data byte
+    STATUS_CP_AFTERTOUCH_PREF_4, // 1 data byte
+    STATUS_PITCH_BEND_PREF_4, // 2 data bytes
+    STATUS_SYS_PREF_4,
+} byte_prefix_4;
+
+typedef enum {
+    STATUS_SYS_EX_SUF_3, // 1+ data bytes //
+    STATUS_SYS_MIDI_MTC_SUF_3, // 1 data byte
+    STATUS_SYS_SONG_POSITION_SUF_3, // 2 data bytes
+    STATUS_SYS_SONG_SELECT_SUF_3, // 1 data byte
+    STATUS_SYS_UNDEFINED_1_SUF_3,
+    STATUS_SYS_UNDEFINED_2_SUF_3,
+    STATUS_SYS_TUNE_REQ_SUF_3, // 0 data bytes
+    STATUS_SYS_EOF_SUF_3, // 0 data bytes
+} byte_suffix_3;
 
 #define TIMESTAMP_HIGH(ts) 0x80 | ((ts >> 7) & 0x3f)
 
 #define TIMESTAMP_LOW(ts) 0x80 | (ts & 0x7f)
 
 #define NOTIFY(processor) do { \
-    ble_notify(processor->buff, processor->buff_len); \
+    processor->sink(processor->buff, processor->buff_len, processor->sink_context); \
     processor->buff_len = 0; \
 } while(0)
 
@@ -24,34 +48,33 @@
         processor->buff_len = 1; \
     } while (0)
 
-static const char *TAG = "PROCESSOR";
-
-void print_byte(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_status(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_status(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_1_of_1(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_1_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_sys_1_of_1(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_sys_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_sys_1_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_sys_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_sys_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_sys_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_status_or_running_status(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_status_or_running_status(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_running_status_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_running_status_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_sysex_1_of_n(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_sysex_1_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+static void process_sysex_i_of_n(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
 
-void process_sysex_i_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
-
-void init_processor(struct processor_t *processor, uint16_t buff_max) {
-    memset(processor, 0, sizeof(struct processor_t));
+void init_baseline_processor(struct baseline_processor_t *processor, uint16_t buff_max, baseline_sink_t sink,
+                             void *context) {
+    memset(processor, 0, sizeof(struct baseline_processor_t));
+    processor->sink = sink;
+    processor->sink_context = context;
     free(processor->buff);
     processor->buff = malloc(sizeof(uint8_t) * buff_max);
     processor->buff_max = buff_max;
@@ -59,135 +82,13 @@ void init_processor(struct processor_t *processor, uint16_t buff_max) {
     processor->process = process_status;
 }
 
-void flush_notify(struct processor_t *processor) {
-    ESP_LOG_BUFFER_HEX(TAG, processor->buff, processor->buff_len);
+void baseline_flush_notify(struct baseline_processor_t *processor) {
     if (processor->buff_len > 0) {
         NOTIFY(processor);
     }
 }
 
-void template(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
-    switch (byte >> 4) {
-        case STATUS_NOTE_OFF_PREF_4:
-            return;
-        case STATUS_NOTE_ON_PREF_4:
-            return;
-        case STATUS_PKP_AFTERTOUCH_PREF_4:
-            return;
-        case STATUS_CC_PREF_4:
-            return;
-        case STATUS_PROGRAM_CHANGE_PREF_4:
-            return;
-        case STATUS_CP_AFTERTOUCH_PREF_4:
-            return;
-        case STATUS_PITCH_BEND_PREF_4:
-            return;
-        case STATUS_SYS_PREF_4:
-            switch (byte & 0x8) {
-                case 0:
-                    switch (byte & 0x7) {
-                        case STATUS_SYS_EX_SUF_3:
-                            // sysex
-                            return;
-                        case STATUS_SYS_MIDI_MTC_SUF_3:
-                            return;
-                        case STATUS_SYS_SONG_POSITION_SUF_3:
-                            return;
-                        case STATUS_SYS_SONG_SELECT_SUF_3:
-                            return;
-                        case STATUS_SYS_UNDEFINED_1_SUF_3:
-                            // ignore
-                            return;
-                        case STATUS_SYS_UNDEFINED_2_SUF_3:
-                            // ignore
-                            return;
-                        case STATUS_SYS_TUNE_REQ_SUF_3:
-                            return;
-                        case STATUS_SYS_EOF_SUF_3:
-                            // sysex
-                            return;
-                        default: // unlikely
-                            return;
-                    }
-                case 1:
-                    ESP_LOGI(TAG, "rt message");
-                    return;
-                default: // unlikely
-                    return;
-            }
-        default:
-            ESP_LOGI(TAG, "data");
-            return;
-    }
-}
-
-void print_byte(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
-    ESP_LOGI(TAG, "wait_for_status");
-    switch (byte >> 4) {
-        case STATUS_NOTE_OFF_PREF_4:
-            ESP_LOGI(TAG, "STATUS_NOTE_OFF_PREF_4");
-            return;
-        case STATUS_NOTE_ON_PREF_4:
-            ESP_LOGI(TAG, "STATUS_NOTE_ON_PREF_4");
-            return;
-        case STATUS_PKP_AFTERTOUCH_PREF_4:
-            ESP_LOGI(TAG, "STATUS_PKP_AFTERTOUCH_PREF_4");
-            return;
-        case STATUS_CC_PREF_4:
-            ESP_LOGI(TAG, "STATUS_CC_PREF_4");
-            return;
-        case STATUS_PROGRAM_CHANGE_PREF_4:
-            ESP_LOGI(TAG, "STATUS_PROGRAM_CHANGE_PREF_4");
-            return;
-        case STATUS_CP_AFTERTOUCH_PREF_4:
-            ESP_LOGI(TAG, "STATUS_CP_AFTERTOUCH_PREF_4");
-            return;
-        case STATUS_PITCH_BEND_PREF_4:
-            ESP_LOGI(TAG, "STATUS_PITCH_BEND_PREF_4");
-            return;
-        case STATUS_SYS_PREF_4:
-            switch (byte & 0x8) {
-                case 0:
-                    switch (byte & 0x7) {
-                        case STATUS_SYS_EX_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_EX_SUF_3");
-                            return;
-                        case STATUS_SYS_MIDI_MTC_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_MIDI_MTC_SUF_3");
-                            return;
-                        case STATUS_SYS_SONG_POSITION_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_SONG_POSITION_SUF_3");
-                            return;
-                        case STATUS_SYS_SONG_SELECT_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_SONG_SELECT_SUF_3");
-                            return;
-                        case STATUS_SYS_UNDEFINED_1_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_UNDEFINED_1_SUF_3");
-                            return;
-                        case STATUS_SYS_UNDEFINED_2_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_UNDEFINED_2_SUF_3");
-                            return;
-                        case STATUS_SYS_TUNE_REQ_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_TUNE_REQ_SUF_3");
-                            return;
-                        case STATUS_SYS_EOF_SUF_3:
-                            ESP_LOGI(TAG, "STATUS_SYS_EOF_SUF_3");
-                            return;
-                        default:
-                            return;
-                    }
-                case 1:
-                    return;
-                default:
-                    return;
-            }
-        default:
-            ESP_LOGI(TAG, "data");
-            return;
-    }
-}
-
-void process_status(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_status(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -282,7 +183,7 @@ void process_status(uint8_t byte, uint16_t timestamp, struct processor_t *proces
     }
 }
 
-void process_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_1_of_1(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -384,7 +285,7 @@ void process_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *proces
     }
 }
 
-void process_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_1_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -481,7 +382,7 @@ void process_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *proces
     }
 }
 
-void process_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -584,7 +485,7 @@ void process_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *proces
     }
 }
 
-void process_sys_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_sys_1_of_1(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -686,7 +587,7 @@ void process_sys_1_of_1(uint8_t byte, uint16_t timestamp, struct processor_t *pr
     }
 }
 
-void process_sys_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_sys_1_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -783,7 +684,7 @@ void process_sys_1_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *pr
     }
 }
 
-void process_sys_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_sys_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -886,7 +787,7 @@ void process_sys_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *pr
     }
 }
 
-void process_status_or_running_status(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_status_or_running_status(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -983,7 +884,7 @@ void process_status_or_running_status(uint8_t byte, uint16_t timestamp, struct p
     }
 }
 
-void process_running_status_2_of_2(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_running_status_2_of_2(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -1093,7 +994,7 @@ void process_running_status_2_of_2(uint8_t byte, uint16_t timestamp, struct proc
     }
 }
 
-void process_sysex_1_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_sysex_1_of_n(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -1195,7 +1096,7 @@ void process_sysex_1_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *
     }
 }
 
-void process_sysex_i_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+static void process_sysex_i_of_n(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
     switch (byte >> 4) {
         case STATUS_NOTE_OFF_PREF_4:
             processor->timestamp = timestamp;
@@ -1295,4 +1196,13 @@ void process_sysex_i_of_n(uint8_t byte, uint16_t timestamp, struct processor_t *
             processor->buff_len++;
             return;
     }
-}
\ No newline at end of file
+}
+
+void baseline_process_byte(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor) {
+    processor->process(byte, timestamp, processor);
+}
+
+void free_baseline_processor(struct baseline_processor_t *processor) {
+    free(processor->buff);
+    processor->buff = NULL;
+}
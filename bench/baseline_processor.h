@@ -0,0 +1,28 @@
+/** The original byte-at-a-time encoder, a function pointer per state, for codec_bench to compare against */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef bool (*baseline_sink_t)(uint8_t *packet, uint16_t len, void *context);
+
+struct baseline_processor_t {
+    uint8_t *buff;
+    uint16_t buff_len;
+    uint16_t buff_max;
+    uint16_t timestamp;
+    uint8_t first_data_byte;
+    uint8_t status;
+    void (*process)(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
+    baseline_sink_t sink;
+    void *sink_context;
+};
+
+void init_baseline_processor(struct baseline_processor_t *processor, uint16_t buff_max, baseline_sink_t sink,
+                             void *context);
+
+void baseline_process_byte(uint8_t byte, uint16_t timestamp, struct baseline_processor_t *processor);
+
+void baseline_flush_notify(struct baseline_processor_t *processor);
+
+void free_baseline_processor(struct baseline_processor_t *processor);
@@ -0,0 +1,195 @@
+/**
+ * Encoder throughput over generated corpora, plus any raw MIDI files given on the command line, at every MTU from the
+ * smallest to the largest:
+ *   codec_bench [file.mid...]
+ * The input is played at wire speed in UART-sized chunks with a flush at every connection event. ns/byte and
+ * packets/s are CPU time, fill is how much of the packets' room the payload takes. Next to both modes of
+ * processor_process_buffer, the byte mode feeds processor_process_byte one byte at a time and old does the same with
+ * the encoder from before the transition table, see baseline_processor.c. byte stays behind old: the table does not
+ * make a byte cheaper, and the packet ring, counters and latency tags cost a little per message and per packet, most
+ * at the smallest MTU. The firmware encodes whole chunks, default is the row to hold against old.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "baseline_processor.h"
+#include "ble_midi.h"
+#include "corpus.h"
+#include "processor.h"
+
+#define CORPUS_SIZE (256 * 1024)
+#define RUN_BYTES (16 * 1024 * 1024) // every corpus is played until this much went through
+#define BYTE_US 320
+#define CONN_INTERVAL_US 7500
+
+struct corpus_t {
+    const char *name;
+    uint8_t *buff;
+    size_t len;
+};
+
+struct sink_count_t {
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+static const uint16_t mtus[] = {23, 64, 185, 247, 517};
+
+static bool count_sink(uint8_t *packet, uint16_t len, void *context) {
+    struct sink_count_t *count = context;
+    (void) packet;
+    count->packets++;
+    count->bytes += len;
+    return true;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool generate(struct corpus_t *corpus, const struct corpus_kind_t *kind) {
+    corpus->name = kind->name;
+    corpus->buff = malloc(CORPUS_SIZE);
+    if (!corpus->buff) return false;
+    corpus->len = kind->generate(corpus->buff, CORPUS_SIZE);
+    return true;
+}
+
+static bool load(struct corpus_t *corpus, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    corpus->name = path;
+    corpus->len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    corpus->buff = malloc(corpus->len ? corpus->len : 1);
+    const bool read = corpus->buff && corpus->len && fread(corpus->buff, 1, corpus->len, file) == corpus->len;
+    fclose(file);
+    return read;
+}
+
+static void report(const struct corpus_t *corpus, uint16_t mtu, const char *mode, double elapsed, uint64_t bytes,
+                   const struct sink_count_t *count, uint16_t buff_max) {
+    printf("%-24s %6u %8s %10.2f %14.0f %9.1f%%\n", corpus->name, mtu, mode, elapsed * 1e9 / bytes,
+           count->packets / elapsed, 100.0 * count->bytes / ((double) count->packets * buff_max));
+}
+
+static void run(const struct corpus_t *corpus, uint16_t mtu, processor_mode mode) {
+    struct processor_t processor = {0};
+    struct sink_count_t count = {0};
+    int64_t now_us = 0;
+    int64_t conn_event_us = CONN_INTERVAL_US;
+    uint64_t bytes = 0;
+
+    init_processor(&processor, mtu - 3, mode, count_sink, &count);
+    const double start = now_sec();
+    while (bytes < RUN_BYTES) {
+        for (size_t i = 0; i < corpus->len; i += BLE_MIDI_UART_CHUNK) {
+            const uint16_t len = corpus->len - i < BLE_MIDI_UART_CHUNK ? corpus->len - i : BLE_MIDI_UART_CHUNK;
+            now_us += len * BYTE_US;
+            while (conn_event_us <= now_us) {
+                flush_notify(&processor);
+                conn_event_us += CONN_INTERVAL_US;
+            }
+            processor_process_buffer(corpus->buff + i, len, now_us, BYTE_US, &processor);
+            processor_drain(&processor);
+        }
+        bytes += corpus->len;
+    }
+    flush_notify(&processor);
+    const double elapsed = now_sec() - start;
+
+    report(corpus, mtu, mode == PROCESSOR_MODE_COMPACT ? "compact" : "default", elapsed, bytes, &count,
+           processor.buff_max);
+}
+
+/** The same playback a byte at a time, through processor_process_byte or through the old encoder */
+static void run_bytes(const struct corpus_t *corpus, uint16_t mtu, bool baseline) {
+    struct processor_t processor = {0};
+    struct baseline_processor_t old = {0};
+    struct sink_count_t count = {0};
+    int64_t now_us = 0;
+    int64_t conn_event_us = CONN_INTERVAL_US;
+    uint64_t bytes = 0;
+
+    if (baseline) {
+        init_baseline_processor(&old, mtu - 3, count_sink, &count);
+    } else {
+        init_processor(&processor, mtu - 3, PROCESSOR_MODE_DEFAULT, count_sink, &count);
+    }
+    const double start = now_sec();
+    while (bytes < RUN_BYTES) {
+        for (size_t i = 0; i < corpus->len; i += BLE_MIDI_UART_CHUNK) {
+            const uint16_t len = corpus->len - i < BLE_MIDI_UART_CHUNK ? corpus->len - i : BLE_MIDI_UART_CHUNK;
+            now_us += len * BYTE_US;
+            while (conn_event_us <= now_us) {
+                if (baseline) {
+                    baseline_flush_notify(&old);
+                } else {
+                    flush_notify(&processor);
+                }
+                conn_event_us += CONN_INTERVAL_US;
+            }
+            for (uint16_t j = 0; j < len; j++) {
+                const uint16_t timestamp = ((now_us - (len - 1 - j) * BYTE_US) / 1000) & BLE_MIDI_TIMESTAMP_MASK;
+                if (baseline) {
+                    baseline_process_byte(corpus->buff[i + j], timestamp, &old);
+                } else {
+                    processor_process_byte(corpus->buff[i + j], timestamp, &processor);
+                }
+            }
+            if (!baseline) processor_drain(&processor);
+        }
+        bytes += corpus->len;
+    }
+    if (baseline) {
+        baseline_flush_notify(&old);
+    } else {
+        flush_notify(&processor);
+    }
+    const double elapsed = now_sec() - start;
+
+    report(corpus, mtu, baseline ? "old" : "byte", elapsed, bytes, &count, mtu - 3);
+    free_baseline_processor(&old);
+}
+
+int main(int argc, char **argv) {
+    const int generated = corpus_kind_count;
+    const int count = generated + argc - 1;
+    struct corpus_t *corpora = calloc(count, sizeof(struct corpus_t));
+
+    if (!corpora) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    for (int i = 0; i < generated; i++) {
+        if (!generate(&corpora[i], &corpus_kinds[i])) {
+            fprintf(stderr, "out of memory\n");
+            return 2;
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!load(&corpora[generated + i - 1], argv[i])) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    printf("%-24s %6s %8s %10s %14s %10s\n", "corpus", "mtu", "mode", "ns/byte", "packets/s", "fill");
+    for (int c = 0; c < count; c++) {
+        for (size_t m = 0; m < sizeof(mtus) / sizeof(mtus[0]); m++) {
+            run(&corpora[c], mtus[m], PROCESSOR_MODE_DEFAULT);
+            run(&corpora[c], mtus[m], PROCESSOR_MODE_COMPACT);
+            run_bytes(&corpora[c], mtus[m], false);
+            run_bytes(&corpora[c], mtus[m], true);
+        }
+    }
+
+    for (int c = 0; c < count; c++) free(corpora[c].buff);
+    free(corpora);
+    return 0;
+}
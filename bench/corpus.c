@@ -0,0 +1,183 @@
+#include <string.h>
+
+#include "corpus.h"
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 16;
+}
+
+void corpus_seed(uint32_t seed) {
+    random_state = seed;
+}
+
+/** Chords and runs across a few channels, note-offs as note-ons with velocity 0 under running status */
+static size_t dense_notes(uint8_t *buff, size_t size) {
+    size_t len = 0;
+    while (len + 16 <= size) {
+        const uint8_t channel = next_random() % 4;
+        const uint8_t note = 36 + next_random() % 48;
+        buff[len++] = 0x90 | channel;
+        for (uint8_t i = 0; i < 3; i++) {
+            buff[len++] = note + i * 4;
+            buff[len++] = 1 + next_random() % 127;
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            buff[len++] = note + i * 4;
+            buff[len++] = 0;
+        }
+        buff[len++] = 0x80 | channel;
+        buff[len++] = note;
+        buff[len++] = 64;
+    }
+    return len;
+}
+
+/** MIDI clock at 120bpm between controller and pitch bend sweeps */
+static size_t clock_cc(uint8_t *buff, size_t size) {
+    size_t len = 0;
+    uint32_t since_clock = 0;
+    uint8_t value = 0;
+    while (len + 8 <= size) {
+        // 24 ticks per beat at 120bpm, one tick every ~65 bytes on the wire
+        if (since_clock >= 65) {
+            buff[len++] = 0xF8;
+            since_clock = 0;
+        }
+        if (next_random() % 8) {
+            buff[len++] = 0xB0 | (next_random() % 2);
+            buff[len++] = 1 + next_random() % 3;
+            buff[len++] = value++ & 0x7F;
+            since_clock += 3;
+        } else {
+            buff[len++] = 0xE0;
+            buff[len++] = value & 0x7F;
+            buff[len++] = (value >> 1) & 0x7F;
+            since_clock += 3;
+        }
+    }
+    return len;
+}
+
+/** Patch dumps of 64KiB each */
+static size_t large_sys_ex(uint8_t *buff, size_t size) {
+    const size_t dump_size = 64 * 1024;
+    size_t len = 0;
+    while (len + dump_size <= size) {
+        buff[len++] = 0xF0;
+        for (size_t i = 1; i < dump_size - 1; i++) buff[len++] = (i * 7 + (i >> 5)) & 0x7F;
+        buff[len++] = 0xF7;
+    }
+    return len;
+}
+
+/** Patch dumps of 4KiB with the clock running through them, stop and start between them, now and then active sensing */
+static size_t sys_ex_realtime(uint8_t *buff, size_t size) {
+    const size_t dump_size = 4 * 1024;
+    size_t len = 0;
+    uint32_t since_clock = 0;
+    // a tick every 65 bytes on the wire, active sensing on top
+    while (len + dump_size + dump_size / 32 <= size) {
+        buff[len++] = 0xF0;
+        for (size_t i = 1; i < dump_size - 1; i++) {
+            if (++since_clock >= 65) {
+                buff[len++] = 0xF8;
+                since_clock = 0;
+            }
+            if (next_random() % 512 == 0) buff[len++] = 0xFE;
+            buff[len++] = next_random() & 0x7F;
+        }
+        buff[len++] = 0xF7;
+        buff[len++] = 0xFC;
+        buff[len++] = 0xFA;
+    }
+    return len;
+}
+
+/** No two messages in a row share a status, a system common message now and then cancels running status outright */
+static size_t alternating_status(uint8_t *buff, size_t size) {
+    static const uint8_t statuses[] = {0x90, 0xB1, 0x80, 0xE2, 0xC3, 0xA0, 0xD1};
+    size_t len = 0;
+    uint32_t i = 0;
+    while (len + 4 <= size) {
+        const uint8_t status = statuses[i++ % sizeof(statuses)];
+        if (i % 16 == 0) {
+            buff[len++] = 0xF3;
+            buff[len++] = next_random() & 0x7F;
+        }
+        buff[len++] = status;
+        buff[len++] = next_random() & 0x7F;
+        if ((status & 0xE0) != 0xC0) buff[len++] = next_random() & 0x7F;
+    }
+    return len;
+}
+
+/**
+ * Everything at random: notes and controllers on a few channels, program changes, song position, every real-time
+ * message, and short SysEx messages with clock ticks and transport messages inside
+ */
+static size_t mixed(uint8_t *buff, size_t size) {
+    static const uint8_t realtime[] = {0xF8, 0xFA, 0xFB, 0xFC, 0xFE};
+    size_t len = 0;
+    while (len + 4 + 2 * 200 <= size) {
+        const uint32_t kind = next_random() % 20;
+        if (kind < 7) {
+            buff[len++] = 0x90 | (next_random() % 4);
+            buff[len++] = next_random() & 0x7F;
+            buff[len++] = next_random() & 0x7F;
+        } else if (kind < 11) {
+            buff[len++] = 0xB0 | (next_random() % 2);
+            buff[len++] = next_random() % 8;
+            buff[len++] = next_random() & 0x7F;
+        } else if (kind < 13) {
+            buff[len++] = realtime[next_random() % sizeof(realtime)];
+        } else if (kind < 14) {
+            buff[len++] = 0xF2;
+            buff[len++] = next_random() & 0x7F;
+            buff[len++] = next_random() & 0x7F;
+        } else if (kind < 15) {
+            buff[len++] = 0xC0;
+            buff[len++] = next_random() & 0x7F;
+        } else {
+            const uint32_t sys_ex_len = next_random() % 200;
+            buff[len++] = 0xF0;
+            for (uint32_t i = 0; i < sys_ex_len; i++) {
+                if (next_random() % 20 == 0) buff[len++] = realtime[next_random() % sizeof(realtime)];
+                buff[len++] = next_random() & 0x7F;
+            }
+            buff[len++] = 0xF7;
+        }
+    }
+    return len;
+}
+
+/**
+ * Line noise: random bytes, one in four a status byte of any kind, so messages are cut short, undefined and stray
+ * EOX bytes land inside them and SysEx is interrupted before and after its first data byte
+ */
+static size_t garbage(uint8_t *buff, size_t size) {
+    size_t len = 0;
+    while (len < size) buff[len++] = next_random() % 4 ? next_random() & 0x7F : 0x80 | (next_random() & 0x7F);
+    return len;
+}
+
+const struct corpus_kind_t corpus_kinds[] = {
+        {"dense-notes", dense_notes},
+        {"clock-cc", clock_cc},
+        {"large-sysex", large_sys_ex},
+        {"sysex-realtime", sys_ex_realtime},
+        {"alternating-status", alternating_status},
+        {"mixed", mixed},
+        {"garbage", garbage},
+};
+
+const size_t corpus_kind_count = sizeof(corpus_kinds) / sizeof(corpus_kinds[0]);
+
+corpus_generator_t corpus_find(const char *name) {
+    for (size_t i = 0; i < corpus_kind_count; i++) {
+        if (strcmp(corpus_kinds[i].name, name) == 0) return corpus_kinds[i].generate;
+    }
+    return NULL;
+}
@@ -0,0 +1,21 @@
+/** Generated MIDI streams for the benchmarks, the same seed gives the same stream */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef size_t (*corpus_generator_t)(uint8_t *buff, size_t size);
+
+struct corpus_kind_t {
+    const char *name;
+    corpus_generator_t generate;
+};
+
+/** Every generator, by the name the tools take on the command line */
+extern const struct corpus_kind_t corpus_kinds[];
+extern const size_t corpus_kind_count;
+
+void corpus_seed(uint32_t seed);
+
+/** The generator called name, NULL if there is none */
+corpus_generator_t corpus_find(const char *name);
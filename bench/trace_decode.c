@@ -0,0 +1,209 @@
+/**
+ * Turns the console output of trace_dump into a timeline of both cores, in microseconds of esp_timer time:
+ *   trace_decode [console.log]
+ * Reads stdin without a file, lines that are not part of the dump are skipped. The timeline is followed by how long
+ * it took from each UART event until the stack took the next notification.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "processor.h"
+#include "trace_event.h"
+
+#define LINE_MAX 1024
+#define CORES_MAX 2
+
+struct event_t {
+    double us;
+    uint8_t core;
+    uint8_t event;
+    uint16_t arg;
+};
+
+struct core_t {
+    uint32_t anchor_cycles;
+    int64_t anchor_us;
+    uint32_t expected;
+    uint32_t count;
+    uint32_t *cycles;
+    uint16_t *args;
+    uint8_t *events;
+};
+
+static const char *event_names[TRACE_EVENTS] = {
+        [TRACE_UART_EVENT] = "uart event",
+        [TRACE_UART_READ] = "uart read",
+        [TRACE_MESSAGE] = "message",
+        [TRACE_CLOSE] = "close",
+        [TRACE_DRAIN] = "drain",
+        [TRACE_CONN_TICK] = "conn tick",
+        [TRACE_FLUSH] = "flush",
+        [TRACE_NOTIFY] = "notify",
+        [TRACE_NOTIFY_SENT] = "notify sent",
+        [TRACE_NOTIFY_FAILED] = "notify failed",
+        [TRACE_MTU] = "mtu",
+};
+
+static const char *close_names[PROCESSOR_CLOSE_CAUSES] = {"full", "urgent", "gap", "flush"};
+
+// ble_notify_result and ble_notify_error in main/lib/include/ble.h
+static const char *result_names[] = {"sent", "queued", "busy", "dropped"};
+static const char *error_names[] = {"no conn", "no mbuf", "enomem", "ebusy", "other", "overflow"};
+
+static struct core_t cores[CORES_MAX];
+
+static void print_arg(const struct event_t *event) {
+    switch (event->event) {
+        case TRACE_MESSAGE:
+            printf("0x%02X\n", event->arg);
+            break;
+        case TRACE_CLOSE:
+            printf("%s\n", event->arg < PROCESSOR_CLOSE_CAUSES ? close_names[event->arg] : "?");
+            break;
+        case TRACE_NOTIFY:
+            printf("%s\n",
+                   event->arg < sizeof(result_names) / sizeof(result_names[0]) ? result_names[event->arg] : "?");
+            break;
+        case TRACE_NOTIFY_FAILED:
+            printf("%s\n", event->arg < sizeof(error_names) / sizeof(error_names[0]) ? error_names[event->arg] : "?");
+            break;
+        default:
+            printf("%u\n", event->arg);
+    }
+}
+
+static int by_time(const void *a, const void *b) {
+    const double delta = ((const struct event_t *) a)->us - ((const struct event_t *) b)->us;
+    return delta < 0 ? -1 : delta > 0;
+}
+
+static void parse_data(struct core_t *core, const char *hex) {
+    unsigned int bytes[sizeof(struct trace_record_t)];
+    while (core->count < core->expected &&
+           sscanf(hex, "%2x%2x%2x%2x%2x%2x%2x%2x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5],
+                  &bytes[6], &bytes[7]) == 8) {
+        core->cycles[core->count] = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+        core->args[core->count] = bytes[4] | bytes[5] << 8;
+        core->events[core->count] = bytes[6];
+        core->count++;
+        hex += 2 * sizeof(struct trace_record_t);
+    }
+}
+
+int main(int argc, char **argv) {
+    FILE *in = argc > 1 ? fopen(argv[1], "r") : stdin;
+    char line[LINE_MAX];
+    unsigned int core_count = 0;
+    unsigned int mhz = 0;
+    struct core_t *core = NULL;
+    bool ended = false;
+
+    if (argc > 2 || !in) {
+        fprintf(stderr, "usage: %s [console.log]\n", argv[0]);
+        return 2;
+    }
+
+    // the last complete dump wins
+    while (fgets(line, sizeof(line), in)) {
+        const char *trace = strstr(line, "trace ");
+        unsigned int index;
+        uint32_t cycles;
+        int64_t us;
+        uint32_t count;
+
+        if (!trace) continue;
+        if (sscanf(trace, "trace begin %u %u", &core_count, &mhz) == 2) {
+            if (core_count > CORES_MAX || !mhz) {
+                fprintf(stderr, "unsupported dump, %u cores at %u MHz\n", core_count, mhz);
+                return 2;
+            }
+            for (unsigned int i = 0; i < CORES_MAX; i++) cores[i].count = cores[i].expected = 0;
+            core = NULL;
+            ended = false;
+        } else if (sscanf(trace, "trace core %u %" SCNu32 " %" SCNd64 " %" SCNu32, &index, &cycles, &us, &count) == 4
+                   && index < core_count) {
+            core = &cores[index];
+            core->anchor_cycles = cycles;
+            core->anchor_us = us;
+            core->expected = count;
+            core->count = 0;
+            core->cycles = realloc(core->cycles, (count ? count : 1) * sizeof(uint32_t));
+            core->args = realloc(core->args, (count ? count : 1) * sizeof(uint16_t));
+            core->events = realloc(core->events, count ? count : 1);
+            if (!core->cycles || !core->args || !core->events) {
+                fprintf(stderr, "out of memory\n");
+                return 2;
+            }
+        } else if (strncmp(trace, "trace data ", 11) == 0 && core) {
+            parse_data(core, trace + 11);
+        } else if (strncmp(trace, "trace end", 9) == 0 && core_count) {
+            ended = true;
+        }
+    }
+    if (in != stdin) fclose(in);
+    if (!ended) {
+        fprintf(stderr, "no complete dump\n");
+        return 1;
+    }
+
+    size_t total = 0;
+    for (unsigned int c = 0; c < core_count; c++) total += cores[c].count;
+    struct event_t *events = malloc((total ? total : 1) * sizeof(struct event_t));
+    if (!events) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+
+    // cycle counts wrap every 2^32 / MHz us, they are unwrapped backwards from the anchor one record at a time
+    size_t n = 0;
+    for (unsigned int c = 0; c < core_count; c++) {
+        uint64_t behind = 0;
+        uint32_t later = cores[c].anchor_cycles;
+        for (uint32_t i = cores[c].count; i-- > 0;) {
+            behind += (uint32_t) (later - cores[c].cycles[i]);
+            later = cores[c].cycles[i];
+            events[n].us = cores[c].anchor_us - (double) behind / mhz;
+            events[n].core = c;
+            events[n].event = cores[c].events[i];
+            events[n].arg = cores[c].args[i];
+            n++;
+        }
+        if (cores[c].count < cores[c].expected) {
+            fprintf(stderr, "core %u: %u of %u records\n", c, cores[c].count, cores[c].expected);
+        }
+    }
+    qsort(events, n, sizeof(struct event_t), by_time);
+
+    printf("%14s %10s %4s  %-14s %s\n", "us", "+us", "core", "event", "arg");
+    double pending_us = -1;
+    double sum_us = 0;
+    double max_us = 0;
+    uint32_t measured = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct event_t *event = &events[i];
+        printf("%14.1f %10.1f %4u  %-14s ", event->us, i ? event->us - events[i - 1].us : 0, event->core,
+               event->event < TRACE_EVENTS && event_names[event->event] ? event_names[event->event] : "?");
+        print_arg(event);
+
+        if (event->event == TRACE_UART_EVENT && pending_us < 0) pending_us = event->us;
+        if (event->event == TRACE_NOTIFY_SENT && pending_us >= 0) {
+            const double elapsed_us = event->us - pending_us;
+            sum_us += elapsed_us;
+            if (elapsed_us > max_us) max_us = elapsed_us;
+            measured++;
+            pending_us = -1;
+        }
+    }
+    printf("uart event to notification %u times, %.1fus mean, %.1fus max\n", measured,
+           measured ? sum_us / measured : 0, max_us);
+
+    free(events);
+    for (unsigned int c = 0; c < CORES_MAX; c++) {
+        free(cores[c].cycles);
+        free(cores[c].args);
+        free(cores[c].events);
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+/** Format constants and helpers shared by the encoder, the decoder, the firmware and the host tools */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BLE_MIDI_TIMESTAMP_MASK 0x1FFF // timestamps are 13 bit milliseconds
+
+#define BLE_MIDI_UART_CHUNK 120 // UART_DATA events at 31250 baud rarely carry more, UART_MIDI_RX_FULL_THRESHOLD
+
+/** Receives one piece of a split packet, a BLE-MIDI packet of its own */
+typedef void (*ble_midi_piece_sink_t)(const uint8_t *piece, uint16_t len, void *context);
+
+/**
+ * Cuts a BLE-MIDI packet into packets of at most max bytes, each behind a header of its own, for a connection with a
+ * smaller MTU than the one it was encoded for. Cuts fall between SysEx data bytes or before a timestamped status
+ * byte, so running status never has to carry over and timestamps keep their wraps. piece is scratch space of at least
+ * max bytes. Returns false, handing nothing to the sink, if the packet is malformed or cannot be cut that fine.
+ */
+bool ble_midi_split(const uint8_t *packet, uint16_t len, uint16_t max, uint8_t *piece, ble_midi_piece_sink_t sink,
+                    void *context);
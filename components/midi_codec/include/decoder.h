@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Receives decoded MIDI: a complete message, a single real-time byte, or a run of SysEx bytes */
+typedef void (*decoder_sink_t)(const uint8_t *bytes, uint16_t len, uint16_t timestamp, void *context);
+
+struct decoder_t {
+    decoder_sink_t sink;
+    void *context;
+    bool sys_ex; // a SysEx message continues into the next packet
+    uint16_t sys_ex_timestamp;
+    uint32_t packet_count;
+    uint32_t malformed_count; // packets dropped from the first byte that does not fit the format
+};
+
+void init_decoder(struct decoder_t *decoder, decoder_sink_t sink, void *context);
+
+/**
+ * Decodes one BLE-MIDI packet: header, timestamps with their low byte wrapping into the header's high bits, running
+ * status with and without a timestamp of its own, and SysEx spanning packets. Timestamps are 13 bit milliseconds
+ * of the sender's clock. Returns false if the packet was malformed, messages before the fault are still delivered.
+ */
+bool decoder_decode(const uint8_t *packet, uint16_t len, struct decoder_t *decoder);
+
+/** Data bytes following a status byte, -1 for SysEx and undefined status bytes */
+int8_t decoder_data_len(uint8_t status);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#define LATENCY_BUCKET_US 250
+
+#define LATENCY_BUCKETS 128 // up to 32ms, the last bucket takes everything above
+
+/** Fixed buckets of LATENCY_BUCKET_US, cheap enough to record every message */
+struct latency_histogram_t {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+};
+
+void latency_record(struct latency_histogram_t *histogram, uint32_t latency_us);
+
+/**
+ * Upper bound of the bucket the given share of latencies falls into, in per mille so p99.9 is 999. Beyond the last
+ * bucket it is the largest latency recorded, 0 if there are none.
+ */
+uint32_t latency_percentile(const struct latency_histogram_t *histogram, uint16_t per_mille);
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency.h"
+
+
+typedef enum {
+    STATUS_NOTE_OFF_PREF_4 = 0x8, // 2 data bytes
+    STATUS_NOTE_ON_PREF_4, // 2 data bytes
+    STATUS_PKP_AFTERTOUCH_PREF_4, // 2 data bytes
+    STATUS_CC_PREF_4, // 2 data bytes
+    STATUS_PROGRAM_CHANGE_PREF_4, // 1 data byte
+    STATUS_CP_AFTERTOUCH_PREF_4, // 1 data byte
+    STATUS_PITCH_BEND_PREF_4, // 2 data bytes
+    STATUS_SYS_PREF_4,
+} byte_prefix_4;
+
+typedef enum {
+    STATUS_SYS_EX_SUF_3, // 1+ data bytes //
+    STATUS_SYS_MIDI_MTC_SUF_3, // 1 data byte
+    STATUS_SYS_SONG_POSITION_SUF_3, // 2 data bytes
+    STATUS_SYS_SONG_SELECT_SUF_3, // 1 data byte
+    STATUS_SYS_UNDEFINED_1_SUF_3,
+    STATUS_SYS_UNDEFINED_2_SUF_3,
+    STATUS_SYS_TUNE_REQ_SUF_3, // 0 data bytes
+    STATUS_SYS_EOF_SUF_3, // 0 data bytes
+} byte_suffix_3;
+
+typedef enum {
+    STATE_STATUS,
+    STATE_1_OF_1,
+    STATE_1_OF_2,
+    STATE_2_OF_2,
+    STATE_SYS_1_OF_1,
+    STATE_SYS_1_OF_2,
+    STATE_SYS_2_OF_2,
+    STATE_RUNNING_1_OF_1,
+    STATE_RUNNING_1_OF_2,
+    STATE_RUNNING_2_OF_2,
+    STATE_SYS_EX_1_OF_N,
+    STATE_SYS_EX_I_OF_N,
+    STATE_COUNT,
+} processor_state;
+
+typedef enum {
+    PROCESSOR_MODE_DEFAULT, // every message carries its own timestamp, running status only as received
+    PROCESSOR_MODE_COMPACT, // smallest valid packet, see emit_compact
+} processor_mode;
+
+typedef enum {
+    PROCESSOR_COALESCE_OFF, // every controller value goes out
+    PROCESSOR_COALESCE_CONGESTED, // values are replaced only while the link is congested, see coalesce_watermark
+    PROCESSOR_COALESCE_ALWAYS, // values in the open packet are always replaced, in queued ones while congested
+} processor_coalesce;
+
+/**
+ * Takes a finished packet, real-time lane or ring packet, and returns false if it cannot right now. The packet then
+ * stays with the processor and is offered again with the next drain.
+ */
+typedef bool (*processor_sink_t)(uint8_t *packet, uint16_t len, void *context);
+
+/** Microseconds on the clock the chunk arrival times passed to processor_process_buffer are on */
+typedef int64_t (*processor_clock_t)(void *context);
+
+typedef enum {
+    PROCESSOR_CLOSE_FULL, // the next message did not fit
+    PROCESSOR_CLOSE_URGENT, // after a chunk with a message in urgent_mask, or ahead of start, continue and stop
+    PROCESSOR_CLOSE_GAP, // the next message came 128ms or more after the packet's last one
+    PROCESSOR_CLOSE_FLUSH, // flush_notify
+    PROCESSOR_CLOSE_CAUSES,
+} processor_close_cause;
+
+#define PROCESSOR_PACKET_COUNT 4
+
+#define PROCESSOR_BUFF_MAX 514 // largest ATT MTU (517) minus the notification header, packets are stored this large
+
+// bit per status byte, set for the ones dropped before they are encoded
+#define PROCESSOR_FILTER_WORDS (256 / 32)
+
+// messages per packet timed for latency, the rest of a fuller packet goes uncounted
+#define PROCESSOR_TIMED_MAX 32
+
+// controller values tracked for coalescing, the oldest is forgotten for a new one
+#define PROCESSOR_PENDING_MAX 16
+
+// real-time bytes collected for the real-time lane until the next drain, their packet stays within the minimum MTU
+#define PROCESSOR_REALTIME_MAX 8
+
+// arrival time of a real-time byte that came in without one, it is left out of the lane statistics
+#define PROCESSOR_ARRIVAL_UNKNOWN INT64_MIN
+
+// the seven channel messages by status, then SysEx, system common and real-time
+#define PROCESSOR_MESSAGE_CLASSES 10
+
+/** Index of a status byte in processor_counters_t.messages */
+#define PROCESSOR_MESSAGE_CLASS(status) \
+    ((status) < 0xF0 ? ((status) >> 4) - 8 : (status) == 0xF0 ? 7 : (status) < 0xF8 ? 8 : 9)
+
+/** Bit of a channel message's status in processor_t.urgent_mask */
+#define PROCESSOR_URGENT(status) (1 << ((status) >> 4))
+
+struct processor_packet_t {
+    uint8_t buff[PROCESSOR_BUFF_MAX];
+    uint16_t len;
+    uint16_t room; // buff_max when it was closed, the link may have changed by the time it is sent
+    bool flushed; // closed by flush_notify rather than by the encoder
+    uint8_t timed;
+    uint32_t closed_us; // low bits of the clock, differences come out right across the wrap
+    uint32_t arrival_us[PROCESSOR_TIMED_MAX]; // of the last byte of each message
+};
+
+/**
+ * Where channel and system common messages spend their time until the sink takes them. A message waits in the open
+ * packet until the encoder closes it, full, urgent or 128ms on, or until flush_notify does, at the flush tick.
+ */
+struct processor_latency_t {
+    struct latency_histogram_t buff; // arrival until the encoder closed the packet
+    struct latency_histogram_t flush; // arrival until flush_notify closed the packet
+    struct latency_histogram_t ring; // closed until the sink took the packet
+    struct latency_histogram_t total; // arrival until the sink took the packet
+};
+
+/** Where a controller value that has not been handed to the stack yet sits, see coalesce */
+struct processor_pending_t {
+    uint8_t status; // 0 for a free entry
+    uint8_t controller; // 0 for pitch bend and channel pressure
+    uint8_t packet; // in packets, the open one included
+    uint16_t offset; // of the value bytes
+};
+
+/** Counted as the encoder goes, a counter is incremented and nothing more */
+struct processor_counters_t {
+    uint32_t messages[PROCESSOR_MESSAGE_CLASSES]; // after the filter, coalesced ones included
+    uint32_t closes[PROCESSOR_CLOSE_CAUSES];
+    uint32_t packets; // queued packets the sink took, the real-time lane not included
+    uint32_t dropped; // queued packets given up on, see dropped_count
+    uint64_t packet_bytes;
+    uint64_t packet_room; // processor_packet_t.room of every packet, the fill ratio is packet_bytes / packet_room
+};
+
+struct processor_realtime_stats_t {
+    uint32_t sent; // real-time bytes handed to the stack
+    uint32_t dropped; // real-time bytes lost because the lane was full while the stack pushed back
+    uint32_t clock_ticks;
+    uint32_t clock_jitter_max_us; // largest change from one clock interval to the next, as they arrived
+    uint64_t clock_jitter_sum_us;
+    uint32_t delay_max_us; // from arrival until the lane is handed to the stack, as of the last chunk read
+    uint64_t delay_sum_us;
+    uint32_t delay_count;
+};
+
+struct processor_t {
+    processor_sink_t sink;
+    void *sink_context;
+    processor_clock_t clock;
+    void *clock_context;
+    struct processor_latency_t *latency; // NULL, or clock NULL, leaves latency unmeasured
+    struct processor_counters_t *counters; // NULL leaves the pipeline uncounted
+    struct processor_packet_t packets[PROCESSOR_PACKET_COUNT]; // ring of packets queued for the stack, plus the open one
+    uint8_t packet_head; // the open packet
+    uint8_t packet_tail; // the oldest queued packet
+    uint8_t packets_queued;
+    uint32_t ring_full_count; // times a packet had to be sent right away to free the next one
+    uint32_t dropped_count; // packets given up on because neither the ring nor the stack had room
+    uint8_t *buff; // the open packet's buffer
+    uint16_t buff_len;
+    uint16_t buff_max;
+    uint16_t timestamp;
+    uint8_t first_data_byte;
+    uint8_t status;
+    uint8_t state;
+    uint8_t mode;
+    uint8_t packet_status;
+    uint16_t packet_timestamp;
+    uint16_t last_timestamp;
+    uint16_t packet_open_timestamp; // the open packet's first message
+    bool header_open; // SysEx continuation, the header takes the high bits of the first timestamp byte that follows
+    uint16_t urgent_mask; // PROCESSOR_URGENT bits of channel messages that close their packet with the chunk
+    bool urgent; // the open packet holds a message in urgent_mask
+    uint32_t filter[PROCESSOR_FILTER_WORDS]; // status bytes dropped before they are encoded
+    uint8_t coalesce; // processor_coalesce
+    uint8_t coalesce_watermark; // queued packets from which on the link counts as congested, at least one
+    uint8_t pending_next;
+    struct processor_pending_t pending[PROCESSOR_PENDING_MAX];
+    uint32_t coalesced_count; // controller values that replaced a pending one
+    uint8_t realtime_buff[1 + 2 * PROCESSOR_REALTIME_MAX]; // real-time lane, ahead of the packets it does not wait for
+    uint8_t realtime_len;
+    uint8_t realtime_behind; // queued packets the lane waits for, they were there before its transport message
+    uint16_t realtime_timestamp; // the lane's last byte
+    int64_t realtime_arrival_us; // the lane's first byte
+    int64_t clock_arrival_us; // the last clock tick
+    uint32_t clock_interval_us;
+    int64_t chunk_end_us; // the last chunk read, stands in for the time the lane is drained
+    struct processor_realtime_stats_t realtime_stats;
+};
+
+/**
+ * Packets go to the sink, every other setting is left at its default and set on the processor afterwards. Nothing is
+ * allocated, buff_max is at most PROCESSOR_BUFF_MAX.
+ */
+void init_processor(struct processor_t *processor, uint16_t buff_max, processor_mode mode, processor_sink_t sink,
+                    void *sink_context);
+
+/**
+ * Changes the packet size, e.g. after an MTU exchange, keeping queued packets and the message, running status or SysEx
+ * in progress. A smaller size closes the open packet if it holds more, queued packets keep the size they were closed
+ * with.
+ */
+void processor_set_buff_max(struct processor_t *processor, uint16_t buff_max);
+
+void processor_process_byte(uint8_t byte, uint16_t timestamp, struct processor_t *processor);
+
+/**
+ * Encodes a chunk of UART bytes. end_us is when the last byte arrived and byte_us how long one byte takes on the
+ * wire, each message is stamped with the arrival time of its status byte, or first data byte under running status.
+ */
+void processor_process_buffer(const uint8_t *buff, uint16_t len, int64_t end_us, uint16_t byte_us,
+                              struct processor_t *processor);
+
+/**
+ * UART bytes still to come before the next message can be encoded: what the one in progress lacks, or a whole one
+ * under the running status. A status byte and two data bytes with no running status, 0 inside SysEx.
+ */
+uint8_t processor_message_remaining(const struct processor_t *processor);
+
+/** Hands the real-time lane, then queued packets oldest first, to the sink until it pushes back */
+void processor_drain(struct processor_t *processor);
+
+/** Queues the open packet, even if it is not full, and drains the queue */
+void flush_notify(struct processor_t *processor);
\ No newline at end of file
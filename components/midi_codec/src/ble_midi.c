@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "ble_midi.h"
+#include "decoder.h"
+
+/** Where a piece starts, and what goes ahead of the bytes it copies from there */
+struct piece_start_t {
+    uint16_t at; // where the piece before it ends
+    uint16_t from; // where its own bytes start, past at by a timestamp that moved into prefix
+    uint8_t header;
+    bool header_set; // from the piece's first timestamp, or the one in prefix
+    uint8_t prefix[2]; // the timestamp and status a running status message needs in a packet of its own
+    uint8_t prefix_len;
+};
+
+/** Hands the piece up to end to the sink, piece holds at least max bytes */
+static void emit(const uint8_t *packet, const struct piece_start_t *start, uint16_t end, uint8_t *piece,
+                 ble_midi_piece_sink_t sink, void *context) {
+    piece[0] = start->header;
+    memcpy(piece + 1, start->prefix, start->prefix_len);
+    memcpy(piece + 1 + start->prefix_len, packet + start->from, end - start->from);
+    sink(piece, 1 + start->prefix_len + end - start->from, context);
+}
+
+static inline uint16_t piece_len(const struct piece_start_t *start, uint16_t end) {
+    return 1 + start->prefix_len + end - start->from;
+}
+
+/**
+ * Walks the packet for the cuts, handing the pieces to the sink only if emitting, returns false if one is too long. A
+ * piece's header carries the high timestamp bits at its first timestamp, wraps before it included, the decoder then
+ * reads the same times out of the pieces as out of the packet.
+ */
+static bool split(const uint8_t *packet, uint16_t len, uint16_t max, bool emitting, uint8_t *piece,
+                  ble_midi_piece_sink_t sink, void *context) {
+    uint16_t high = packet[0] & 0x3F;
+    uint8_t low = 0;
+    uint8_t status = 0; // running status, it only holds within a packet
+    // a packet starting with data continues a SysEx message
+    bool sys_ex = !(packet[1] & 0x80);
+    struct piece_start_t start = {.at = 1, .from = 1, .header = packet[0], .header_set = true};
+    struct piece_start_t cut = {0}; // the last place the piece could end, at 0 if none yet
+    uint16_t i = 1;
+
+    while (true) {
+        // a piece may end before SysEx data, before a message, and at the end, not before a real-time byte outside
+        // SysEx with running status data still to come after it
+        struct piece_start_t next = {.at = i, .from = i, .header = 0x80 | (high & 0x3F)};
+        bool can_cut = i == len;
+        if (i < len && sys_ex && !(packet[i] & 0x80)) {
+            can_cut = true;
+        } else if (i + 1 < len && (packet[i] & 0x80)) {
+            if (!(packet[i + 1] & 0x80)) {
+                // running status with a timestamp of its own, the status goes in after it
+                can_cut = status != 0;
+                next.prefix[0] = packet[i];
+                next.prefix[1] = status;
+                next.prefix_len = 2;
+                next.from = i + 1;
+                next.header = 0x80 | (((packet[i] & 0x7F) < low ? high + 1 : high) & 0x3F);
+                next.header_set = true;
+            } else {
+                can_cut = sys_ex || packet[i + 1] < 0xF8 || !status;
+            }
+        } else if (i < len && !(packet[i] & 0x80)) {
+            // running status under the previous timestamp, both go in ahead of it
+            can_cut = status != 0;
+            next.prefix[0] = 0x80 | low;
+            next.prefix[1] = status;
+            next.prefix_len = 2;
+            next.header_set = true;
+        }
+
+        if (can_cut && i > start.from) {
+            if (piece_len(&start, i) > max) {
+                if (!cut.at) return false;
+                if (emitting) emit(packet, &start, cut.at, piece, sink, context);
+                start = cut;
+                if (piece_len(&start, i) > max) return false;
+            }
+            cut = next;
+        }
+        if (i == len) break;
+
+        if (sys_ex && !(packet[i] & 0x80)) {
+            i++;
+            continue;
+        }
+        if (packet[i] & 0x80) {
+            // timestamp byte, the low 7 bits wrapping around carry into the high bits
+            if ((packet[i] & 0x7F) < low) high++;
+            low = packet[i] & 0x7F;
+            if (!start.header_set) start.header = 0x80 | (high & 0x3F);
+            if (!cut.header_set) cut.header = 0x80 | (high & 0x3F);
+            start.header_set = cut.header_set = true;
+            if (++i == len) return false;
+        }
+        if (packet[i] & 0x80) {
+            const uint8_t byte = packet[i++];
+            if (byte >= 0xF8) continue;
+            status = byte;
+            sys_ex = status == 0xF0;
+            if (status == 0xF0 || status == 0xF7) {
+                status = 0;
+                continue;
+            }
+        }
+        const int8_t data_len = decoder_data_len(status);
+        if (!status || data_len < 0) return false;
+        i += data_len;
+        if (i > len) return false;
+        // system common cancels running status
+        if (status >= 0xF0) status = 0;
+    }
+
+    if (emitting) emit(packet, &start, len, piece, sink, context);
+    return true;
+}
+
+bool ble_midi_split(const uint8_t *packet, uint16_t len, uint16_t max, uint8_t *piece, ble_midi_piece_sink_t sink,
+                    void *context) {
+    if (len < 2 || max < 2) return false;
+    if (!split(packet, len, max, false, piece, sink, context)) return false;
+    return split(packet, len, max, true, piece, sink, context);
+}
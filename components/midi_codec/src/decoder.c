@@ -0,0 +1,123 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "ble_midi.h"
+#include "decoder.h"
+
+void init_decoder(struct decoder_t *decoder, decoder_sink_t sink, void *context) {
+    memset(decoder, 0, sizeof(struct decoder_t));
+    decoder->sink = sink;
+    decoder->context = context;
+}
+
+int8_t decoder_data_len(uint8_t status) {
+    switch (status >> 4) {
+        case 0xC:
+        case 0xD:
+            return 1;
+        case 0xF:
+            break;
+        default:
+            return 2;
+    }
+    switch (status) {
+        case 0xF1:
+        case 0xF3:
+            return 1;
+        case 0xF2:
+            return 2;
+        case 0xF6:
+        case 0xF7:
+            return 0;
+        default:
+            return status >= 0xF8 ? 0 : -1;
+    }
+}
+
+/** Hands a SysEx data run to the sink, returns where the run ended */
+static uint16_t sys_ex_data(const uint8_t *packet, uint16_t i, uint16_t len, struct decoder_t *decoder) {
+    const uint16_t start = i;
+    while (i < len && !(packet[i] & 0x80)) i++;
+    if (i > start) decoder->sink(packet + start, i - start, decoder->sys_ex_timestamp, decoder->context);
+    return i;
+}
+
+bool decoder_decode(const uint8_t *packet, uint16_t len, struct decoder_t *decoder) {
+    uint16_t i = 1;
+    uint16_t high;
+    uint16_t low = 0;
+    uint16_t timestamp;
+    uint8_t status = 0; // running status, it only holds within a packet
+    uint8_t message[3];
+    int8_t data_len;
+
+    decoder->packet_count++;
+    if (len < 2 || (packet[0] & 0xC0) != 0x80) goto malformed;
+    high = packet[0] & 0x3F;
+    timestamp = high << 7;
+
+    // a continuation packet starts right with SysEx data
+    if (decoder->sys_ex) i = sys_ex_data(packet, i, len, decoder);
+
+    while (i < len) {
+        if (packet[i] & 0x80) {
+            // timestamp byte, the low 7 bits wrapping around carry into the high bits
+            if ((packet[i] & 0x7F) < low) high++;
+            low = packet[i] & 0x7F;
+            timestamp = ((high << 7) | low) & BLE_MIDI_TIMESTAMP_MASK;
+            if (++i == len) goto malformed;
+        } else if (decoder->sys_ex || !status) {
+            goto malformed;
+        }
+        // else data right after a message: running status with the previous timestamp
+
+        if (packet[i] >= 0xF8) {
+            decoder->sink(packet + i, 1, timestamp, decoder->context);
+            i++;
+            if (decoder->sys_ex) i = sys_ex_data(packet, i, len, decoder);
+            continue;
+        }
+
+        if (packet[i] & 0x80) {
+            status = packet[i++];
+            if (decoder->sys_ex && status != 0xF7) {
+                // any other status byte ends SysEx on the wire just the same
+                decoder->sys_ex = false;
+            }
+            if (status == 0xF7) {
+                if (!decoder->sys_ex) goto malformed;
+                decoder->sys_ex = false;
+                decoder->sink(&status, 1, timestamp, decoder->context);
+                status = 0;
+                continue;
+            }
+            if (status == 0xF0) {
+                decoder->sys_ex = true;
+                decoder->sys_ex_timestamp = timestamp;
+                decoder->sink(&status, 1, timestamp, decoder->context);
+                status = 0;
+                i = sys_ex_data(packet, i, len, decoder);
+                continue;
+            }
+        } else if (!status) {
+            goto malformed;
+        }
+
+        data_len = decoder_data_len(status);
+        if (data_len < 0 || i + data_len > len) goto malformed;
+        message[0] = status;
+        for (int8_t j = 0; j < data_len; j++) {
+            if (packet[i] & 0x80) goto malformed;
+            message[1 + j] = packet[i++];
+        }
+        decoder->sink(message, 1 + data_len, timestamp, decoder->context);
+        // system common cancels running status
+        if (status >= 0xF0) status = 0;
+    }
+    return true;
+
+    malformed:
+    decoder->malformed_count++;
+    decoder->sys_ex = false;
+    return false;
+}
@@ -0,0 +1,25 @@
+#include "latency.h"
+
+void latency_record(struct latency_histogram_t *histogram, uint32_t latency_us) {
+    const uint32_t bucket = latency_us / LATENCY_BUCKET_US;
+    histogram->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    histogram->count++;
+    histogram->sum_us += latency_us;
+    if (latency_us > histogram->max_us) histogram->max_us = latency_us;
+}
+
+uint32_t latency_percentile(const struct latency_histogram_t *histogram, uint16_t per_mille) {
+    if (!histogram->count) return 0;
+
+    // the smallest latency that this share of them does not exceed, rounded up
+    const uint64_t rank = ((uint64_t) histogram->count * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            const uint32_t bound_us = (i + 1) * LATENCY_BUCKET_US;
+            return bound_us < histogram->max_us ? bound_us : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
@@ -0,0 +1,964 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ble_midi.h"
+#include "processor.h"
+
+#ifdef ESP_PLATFORM
+#include "trace.h"
+#else
+#define TRACE(event, arg) ((void) 0)
+#endif
+
+#define TIMESTAMP_HIGH(ts) 0x80 | ((ts >> 7) & 0x3f)
+
+#define TIMESTAMP_LOW(ts) 0x80 | (ts & 0x7f)
+
+#define TIMESTAMP_NONE 0xFFFF
+
+#define CLOSE_PACKET(cause, processor) close_packet(cause, processor)
+
+#define FLUSH_NOTIFY_IF_EXCEED(size, processor) \
+    if (processor->buff_len + size > processor->buff_max) CLOSE_PACKET(PROCESSOR_CLOSE_FULL, processor)
+
+#define COUNT(counter, processor) \
+    if (processor->counters) processor->counters->counter++
+
+#define COUNT_MESSAGE(status, processor) do { \
+        TRACE(TRACE_MESSAGE, status); \
+        COUNT(messages[PROCESSOR_MESSAGE_CLASS(status)], processor); \
+    } while (0)
+
+#define SET_HIGH_TIMESTAMP_IF_EMPTY_BUF(timestamp, processor) \
+    if (processor->buff_len == 0) do { \
+        processor->buff[0] = TIMESTAMP_HIGH(timestamp); \
+        processor->buff_len = 1; \
+        processor->packet_open_timestamp = timestamp; \
+    } while (0)
+
+/** Packs an action and the state to continue in into a single table cell */
+#define T(action, state) (uint8_t) ((action) << 4 | (state))
+
+#define T_ACTION(transition) ((transition) >> 4)
+
+#define T_STATE(transition) ((transition) & 0xf)
+
+typedef enum {
+    CLASS_DATA, // 0x00 - 0x7F
+    CLASS_CHANNEL_1, // channel message with 1 data byte
+    CLASS_CHANNEL_2, // channel message with 2 data bytes
+    CLASS_SYS_EX, // 0xF0
+    CLASS_SYS_1, // system common with 1 data byte
+    CLASS_SYS_2, // system common with 2 data bytes
+    CLASS_SYS_0, // system common without data bytes
+    CLASS_SYS_EOX, // 0xF7
+    CLASS_SYS_UNDEFINED, // 0xF4, 0xF5
+    CLASS_REALTIME, // 0xF8 - 0xFF
+    CLASS_COUNT,
+} byte_class;
+
+typedef enum {
+    ACTION_IGNORE,
+    ACTION_STATUS, // remember status byte and its timestamp
+    ACTION_DATA, // remember first data byte
+    ACTION_RUNNING_DATA, // remember first data byte, the message is timed by it as there is no status byte
+    ACTION_EMIT_SINGLE, // timestamp, byte
+    ACTION_EMIT_1, // timestamp, status, byte
+    ACTION_EMIT_2, // timestamp, status, first data byte, byte
+    ACTION_EMIT_RUNNING_1, // timestamp, byte
+    ACTION_EMIT_RUNNING_2, // timestamp, first data byte, byte
+    ACTION_SYS_EX_START, // timestamp, 0xF0, byte
+    ACTION_SYS_EX_DATA, // byte
+    ACTION_SYS_EX_END, // timestamp, 0xF7
+    ACTION_SYS_EX_EMPTY, // timestamp, 0xF0, timestamp, 0xF7
+    ACTION_SYS_EX_INTERRUPT, // timestamp, 0xF7, then the status byte from STATE_STATUS
+    ACTION_REALTIME, // timestamp, byte in the real-time lane, the state stays as it is
+} action;
+
+static const uint8_t byte_classes[256] = {
+        [0x00 ... 0x7F] = CLASS_DATA,
+        [0x80 ... 0xBF] = CLASS_CHANNEL_2,
+        [0xC0 ... 0xDF] = CLASS_CHANNEL_1,
+        [0xE0 ... 0xEF] = CLASS_CHANNEL_2,
+        [0xF0] = CLASS_SYS_EX,
+        [0xF1] = CLASS_SYS_1,
+        [0xF2] = CLASS_SYS_2,
+        [0xF3] = CLASS_SYS_1,
+        [0xF4 ... 0xF5] = CLASS_SYS_UNDEFINED,
+        [0xF6] = CLASS_SYS_0,
+        [0xF7] = CLASS_SYS_EOX,
+        [0xF8 ... 0xFF] = CLASS_REALTIME,
+};
+
+/** Status bytes behave the same in every state, except for EOX which only matters inside SysEx */
+#define STATUS_TRANSITIONS(state) \
+        [CLASS_CHANNEL_1] = T(ACTION_STATUS, STATE_1_OF_1), \
+        [CLASS_CHANNEL_2] = T(ACTION_STATUS, STATE_1_OF_2), \
+        [CLASS_SYS_EX] = T(ACTION_STATUS, STATE_SYS_EX_1_OF_N), \
+        [CLASS_SYS_1] = T(ACTION_STATUS, STATE_SYS_1_OF_1), \
+        [CLASS_SYS_2] = T(ACTION_STATUS, STATE_SYS_1_OF_2), \
+        [CLASS_SYS_0] = T(ACTION_EMIT_SINGLE, STATE_STATUS), \
+        [CLASS_SYS_UNDEFINED] = T(ACTION_IGNORE, state), \
+        [CLASS_REALTIME] = T(ACTION_REALTIME, state)
+
+static const uint8_t transitions[STATE_COUNT][CLASS_COUNT] = {
+        [STATE_STATUS] = {
+                [CLASS_DATA] = T(ACTION_IGNORE, STATE_STATUS),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_STATUS),
+                STATUS_TRANSITIONS(STATE_STATUS),
+        },
+        [STATE_1_OF_1] = {
+                [CLASS_DATA] = T(ACTION_EMIT_1, STATE_RUNNING_1_OF_1),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_1_OF_1),
+                STATUS_TRANSITIONS(STATE_1_OF_1),
+        },
+        [STATE_1_OF_2] = {
+                [CLASS_DATA] = T(ACTION_DATA, STATE_2_OF_2),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_1_OF_2),
+                STATUS_TRANSITIONS(STATE_1_OF_2),
+        },
+        [STATE_2_OF_2] = {
+                [CLASS_DATA] = T(ACTION_EMIT_2, STATE_RUNNING_1_OF_2),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_2_OF_2),
+                STATUS_TRANSITIONS(STATE_2_OF_2),
+        },
+        [STATE_SYS_1_OF_1] = {
+                [CLASS_DATA] = T(ACTION_EMIT_1, STATE_STATUS),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_SYS_1_OF_1),
+                STATUS_TRANSITIONS(STATE_SYS_1_OF_1),
+        },
+        [STATE_SYS_1_OF_2] = {
+                [CLASS_DATA] = T(ACTION_DATA, STATE_SYS_2_OF_2),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_SYS_1_OF_2),
+                STATUS_TRANSITIONS(STATE_SYS_1_OF_2),
+        },
+        [STATE_SYS_2_OF_2] = {
+                [CLASS_DATA] = T(ACTION_EMIT_2, STATE_STATUS),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_SYS_2_OF_2),
+                STATUS_TRANSITIONS(STATE_SYS_2_OF_2),
+        },
+        [STATE_RUNNING_1_OF_1] = {
+                [CLASS_DATA] = T(ACTION_EMIT_RUNNING_1, STATE_RUNNING_1_OF_1),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_RUNNING_1_OF_1),
+                STATUS_TRANSITIONS(STATE_RUNNING_1_OF_1),
+        },
+        [STATE_RUNNING_1_OF_2] = {
+                [CLASS_DATA] = T(ACTION_RUNNING_DATA, STATE_RUNNING_2_OF_2),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_RUNNING_1_OF_2),
+                STATUS_TRANSITIONS(STATE_RUNNING_1_OF_2),
+        },
+        [STATE_RUNNING_2_OF_2] = {
+                [CLASS_DATA] = T(ACTION_EMIT_RUNNING_2, STATE_RUNNING_1_OF_2),
+                [CLASS_SYS_EOX] = T(ACTION_IGNORE, STATE_RUNNING_2_OF_2),
+                STATUS_TRANSITIONS(STATE_RUNNING_2_OF_2),
+        },
+        [STATE_SYS_EX_1_OF_N] = {
+                [CLASS_DATA] = T(ACTION_SYS_EX_START, STATE_SYS_EX_I_OF_N),
+                [CLASS_SYS_EOX] = T(ACTION_SYS_EX_EMPTY, STATE_STATUS),
+                STATUS_TRANSITIONS(STATE_SYS_EX_1_OF_N),
+        },
+        [STATE_SYS_EX_I_OF_N] = {
+                // any status byte but real-time ends SysEx, the receiver gets an explicit EOX for it
+                [CLASS_DATA] = T(ACTION_SYS_EX_DATA, STATE_SYS_EX_I_OF_N),
+                [CLASS_CHANNEL_1] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_CHANNEL_2] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_SYS_EX] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_SYS_1] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_SYS_2] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_SYS_0] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_SYS_EOX] = T(ACTION_SYS_EX_END, STATE_STATUS),
+                [CLASS_SYS_UNDEFINED] = T(ACTION_SYS_EX_INTERRUPT, STATE_STATUS),
+                [CLASS_REALTIME] = T(ACTION_REALTIME, STATE_SYS_EX_I_OF_N),
+        },
+};
+
+void init_processor(struct processor_t *processor, uint16_t buff_max, processor_mode mode, processor_sink_t sink,
+                    void *sink_context) {
+    memset(processor, 0, sizeof(struct processor_t));
+    processor->buff = processor->packets[0].buff;
+    processor->sink = sink;
+    processor->sink_context = sink_context;
+    processor->buff_max = buff_max < PROCESSOR_BUFF_MAX ? buff_max : PROCESSOR_BUFF_MAX;
+    processor->buff_len = 0;
+    processor->mode = mode;
+    processor->state = STATE_STATUS;
+    processor->packet_timestamp = TIMESTAMP_NONE;
+    processor->clock_arrival_us = PROCESSOR_ARRIVAL_UNKNOWN;
+}
+
+uint8_t processor_message_remaining(const struct processor_t *processor) {
+    static const uint8_t remaining[STATE_COUNT] = {
+            [STATE_STATUS] = 3,
+            [STATE_1_OF_1] = 1,
+            [STATE_1_OF_2] = 2,
+            [STATE_2_OF_2] = 1,
+            [STATE_SYS_1_OF_1] = 1,
+            [STATE_SYS_1_OF_2] = 2,
+            [STATE_SYS_2_OF_2] = 1,
+            [STATE_RUNNING_1_OF_1] = 1,
+            [STATE_RUNNING_1_OF_2] = 2,
+            [STATE_RUNNING_2_OF_2] = 1,
+    };
+    return remaining[processor->state];
+}
+
+static inline bool is_timed(const struct processor_t *processor) {
+    return processor->latency && processor->clock;
+}
+
+/** Chunk arrival times are estimates, a message can seem to arrive a little after a later event */
+static inline uint32_t elapsed_us(uint32_t from_us, uint32_t to_us) {
+    const int32_t elapsed = to_us - from_us;
+    return elapsed > 0 ? elapsed : 0;
+}
+
+/** Records the latencies of the packet's messages as the sink takes it */
+static void time_packet(const struct processor_packet_t *packet, struct processor_t *processor) {
+    if (!packet->timed || !is_timed(processor)) return;
+
+    struct processor_latency_t *latency = processor->latency;
+    const uint32_t now_us = processor->clock(processor->clock_context);
+    const uint32_t ring_us = elapsed_us(packet->closed_us, now_us);
+    for (uint8_t i = 0; i < packet->timed; i++) {
+        latency_record(packet->flushed ? &latency->flush : &latency->buff,
+                       elapsed_us(packet->arrival_us[i], packet->closed_us));
+        latency_record(&latency->ring, ring_us);
+        latency_record(&latency->total, elapsed_us(packet->arrival_us[i], now_us));
+    }
+}
+
+static void release_packet(struct processor_t *processor) {
+    if (processor->coalesce) {
+        // values in the packet are out of reach from here on
+        for (uint8_t i = 0; i < PROCESSOR_PENDING_MAX; i++) {
+            if (processor->pending[i].packet == processor->packet_tail) processor->pending[i].status = 0;
+        }
+    }
+    processor->packet_tail = (processor->packet_tail + 1) % PROCESSOR_PACKET_COUNT;
+    processor->packets_queued--;
+    if (processor->realtime_behind > 0) processor->realtime_behind--;
+}
+
+/** Hands the oldest queued packet to the sink, returns false if the sink pushes back and it stays queued */
+static bool send_packet(struct processor_t *processor) {
+    struct processor_packet_t *packet = &processor->packets[processor->packet_tail];
+    if (!processor->sink(packet->buff, packet->len, processor->sink_context)) {
+        return false;
+    }
+    if (processor->counters) {
+        processor->counters->packets++;
+        processor->counters->packet_bytes += packet->len;
+        processor->counters->packet_room += packet->room;
+    }
+    time_packet(packet, processor);
+    release_packet(processor);
+    return true;
+}
+
+/** Hands the real-time lane to the sink, returns false if the sink pushes back and it stays in the lane */
+static bool send_realtime(struct processor_t *processor) {
+    struct processor_realtime_stats_t *stats = &processor->realtime_stats;
+    if (!processor->sink(processor->realtime_buff, processor->realtime_len, processor->sink_context)) {
+        return false;
+    }
+    stats->sent += processor->realtime_len / 2;
+    if (processor->realtime_arrival_us != PROCESSOR_ARRIVAL_UNKNOWN) {
+        const uint32_t delay_us = processor->chunk_end_us - processor->realtime_arrival_us;
+        if (delay_us > stats->delay_max_us) stats->delay_max_us = delay_us;
+        stats->delay_sum_us += delay_us;
+        stats->delay_count++;
+    }
+    processor->realtime_len = 0;
+    return true;
+}
+
+/** Sends the packets a transport message in the lane has to wait for, then the lane */
+static bool send_lane(struct processor_t *processor) {
+    while (processor->realtime_behind > 0) {
+        if (!send_packet(processor)) return false;
+    }
+    return send_realtime(processor);
+}
+
+/** Clock jitter is how much an interval between ticks differs from the one before */
+static void count_clock_tick(int64_t arrival_us, struct processor_t *processor) {
+    struct processor_realtime_stats_t *stats = &processor->realtime_stats;
+    stats->clock_ticks++;
+    if (arrival_us == PROCESSOR_ARRIVAL_UNKNOWN) {
+        processor->clock_arrival_us = PROCESSOR_ARRIVAL_UNKNOWN;
+        return;
+    }
+    if (processor->clock_arrival_us != PROCESSOR_ARRIVAL_UNKNOWN) {
+        const uint32_t interval_us = arrival_us - processor->clock_arrival_us;
+        if (processor->clock_interval_us) {
+            const uint32_t jitter_us = interval_us > processor->clock_interval_us
+                                       ? interval_us - processor->clock_interval_us
+                                       : processor->clock_interval_us - interval_us;
+            if (jitter_us > stats->clock_jitter_max_us) stats->clock_jitter_max_us = jitter_us;
+            stats->clock_jitter_sum_us += jitter_us;
+        }
+        processor->clock_interval_us = interval_us;
+    }
+    processor->clock_arrival_us = arrival_us;
+}
+
+static inline bool is_filtered(uint8_t status, const struct processor_t *processor) {
+    return processor->filter[status >> 5] >> (status & 31) & 1;
+}
+
+static void close_packet(processor_close_cause cause, struct processor_t *processor);
+
+/**
+ * Real-time bytes skip the open packet, which may be waiting on a flush or deep in a SysEx dump. They gather in a
+ * packet of their own that goes out ahead of the queued packets with the next drain. Only clock, tick and active
+ * sensing may overtake other messages: start, continue and stop first close the open packet and send what is queued,
+ * if the stack pushes back the lane waits for those packets.
+ */
+static void realtime(uint8_t byte, uint16_t timestamp, int64_t arrival_us, struct processor_t *processor) {
+    if (is_filtered(byte, processor)) return;
+    COUNT_MESSAGE(byte, processor);
+    const bool transport = byte >= 0xFA && byte <= 0xFC;
+    if (transport) {
+        if (processor->buff_len > 0) CLOSE_PACKET(PROCESSOR_CLOSE_URGENT, processor);
+        processor_drain(processor);
+    }
+    const bool full = processor->realtime_len == sizeof(processor->realtime_buff);
+    // see packet_order
+    const bool apart = ((timestamp - processor->realtime_timestamp) & BLE_MIDI_TIMESTAMP_MASK) > 0x7F;
+    if (processor->realtime_len > 0 && (full || apart) && !send_lane(processor)) {
+        processor->realtime_stats.dropped++;
+        return;
+    }
+    if (processor->realtime_len == 0) {
+        processor->realtime_buff[0] = TIMESTAMP_HIGH(timestamp);
+        processor->realtime_len = 1;
+        processor->realtime_arrival_us = arrival_us;
+    }
+    processor->realtime_buff[processor->realtime_len++] = TIMESTAMP_LOW(timestamp);
+    processor->realtime_buff[processor->realtime_len++] = byte;
+    processor->realtime_timestamp = timestamp;
+    if (transport) processor->realtime_behind = processor->packets_queued;
+    if (byte == 0xF8) count_clock_tick(arrival_us, processor);
+}
+
+/** Queues the open packet and continues in the next free one, the encoder never waits for the stack */
+static void close_packet(processor_close_cause cause, struct processor_t *processor) {
+    TRACE(TRACE_CLOSE, cause);
+    COUNT(closes[cause], processor);
+    if (processor->packets_queued == PROCESSOR_PACKET_COUNT - 1) {
+        // every other packet is still queued, the oldest one has to go out before this one can be reused
+        processor->ring_full_count++;
+        // a transport message in the lane came before every queued packet it does not wait for
+        const bool lane_due = processor->realtime_len > 0 && processor->realtime_behind == 0;
+        if ((lane_due && !send_realtime(processor)) || !send_packet(processor)) {
+            // the stack is backed up too, the oldest packet is the one given up on
+            processor->dropped_count++;
+            COUNT(dropped, processor);
+            release_packet(processor);
+        }
+    }
+    struct processor_packet_t *packet = &processor->packets[processor->packet_head];
+    packet->len = processor->buff_len;
+    packet->room = processor->buff_max;
+    if (packet->timed && is_timed(processor)) packet->closed_us = processor->clock(processor->clock_context);
+    processor->packet_head = (processor->packet_head + 1) % PROCESSOR_PACKET_COUNT;
+    processor->packets_queued++;
+
+    processor->packets[processor->packet_head].flushed = false;
+    processor->packets[processor->packet_head].timed = 0;
+
+    processor->buff = processor->packets[processor->packet_head].buff;
+    processor->buff_len = 0;
+    processor->packet_status = 0;
+    processor->packet_timestamp = TIMESTAMP_NONE;
+    processor->header_open = false;
+    processor->urgent = false;
+}
+
+void processor_set_buff_max(struct processor_t *processor, uint16_t buff_max) {
+    if (buff_max > PROCESSOR_BUFF_MAX) buff_max = PROCESSOR_BUFF_MAX;
+    if (processor->buff_len > buff_max) CLOSE_PACKET(PROCESSOR_CLOSE_FULL, processor);
+    processor->buff_max = buff_max;
+}
+
+void processor_drain(struct processor_t *processor) {
+    if (processor->realtime_len > 0 && !send_lane(processor)) return;
+    while (processor->packets_queued > 0 && send_packet(processor));
+}
+
+void flush_notify(struct processor_t *processor) {
+    if (processor->buff_len > 0) {
+        processor->packets[processor->packet_head].flushed = true;
+        CLOSE_PACKET(PROCESSOR_CLOSE_FLUSH, processor);
+    }
+    processor_drain(processor);
+}
+
+/**
+ * Timestamps must not go backwards within a packet, a receiver would take that for a wrap-around. Neither may two of
+ * them lie 128ms or more apart, the receiver could not tell how often the low byte wrapped in between.
+ */
+static inline uint16_t packet_order(uint16_t timestamp, struct processor_t *processor) {
+    if (processor->buff_len > 0 && !processor->header_open) {
+        const uint16_t delta = (timestamp - processor->last_timestamp) & BLE_MIDI_TIMESTAMP_MASK;
+        if (delta > BLE_MIDI_TIMESTAMP_MASK / 2) return processor->last_timestamp;
+        if (delta > 0x7F) CLOSE_PACKET(PROCESSOR_CLOSE_GAP, processor);
+    }
+    return timestamp;
+}
+
+/** Makes room for size bytes in the packet and returns where to write them */
+static inline uint8_t *reserve(uint16_t size, uint16_t timestamp, struct processor_t *processor) {
+    FLUSH_NOTIFY_IF_EXCEED(size, processor);
+    SET_HIGH_TIMESTAMP_IF_EMPTY_BUF(timestamp, processor);
+    if (processor->header_open) {
+        // a receiver reads the header's high bits together with the packet's first timestamp byte, this one
+        processor->buff[0] = TIMESTAMP_HIGH(timestamp);
+        processor->header_open = false;
+    }
+    uint8_t *dst = processor->buff + processor->buff_len;
+    processor->buff_len += size;
+    processor->last_timestamp = timestamp;
+    return dst;
+}
+
+static inline void emit_single(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+    timestamp = packet_order(timestamp, processor);
+    uint8_t *dst = reserve(2, timestamp, processor);
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = byte;
+    processor->packet_status = 0;
+    processor->packet_timestamp = TIMESTAMP_NONE;
+}
+
+/**
+ * Writes the smallest encoding the BLE-MIDI spec allows: the status byte is left out while it matches the packet's
+ * running status, and the timestamp byte is left out as well when it also matches the previous message.
+ */
+static void emit_compact(uint8_t first, uint8_t second, uint8_t data_len, uint16_t timestamp,
+                         struct processor_t *processor) {
+    uint8_t *dst;
+
+    timestamp = packet_order(timestamp, processor);
+
+    if (processor->status >= 0xF0) {
+        // system common and SysEx cancel running status
+        dst = reserve(2 + data_len, timestamp, processor);
+        dst[0] = TIMESTAMP_LOW(timestamp);
+        dst[1] = processor->status;
+        dst[2] = first;
+        if (data_len == 2) dst[3] = second;
+        processor->packet_status = 0;
+        processor->packet_timestamp = TIMESTAMP_NONE;
+        return;
+    }
+
+    bool running = processor->packet_status == processor->status;
+    bool timestamped = !running || processor->packet_timestamp != timestamp;
+    if (processor->buff_len + data_len + !running + timestamped > processor->buff_max) {
+        CLOSE_PACKET(PROCESSOR_CLOSE_FULL, processor);
+        running = false;
+        timestamped = true;
+    }
+
+    dst = reserve(data_len + !running + timestamped, timestamp, processor);
+    if (timestamped) *dst++ = TIMESTAMP_LOW(timestamp);
+    if (!running) *dst++ = processor->status;
+    dst[0] = first;
+    if (data_len == 2) dst[1] = second;
+    processor->packet_status = processor->status;
+    processor->packet_timestamp = timestamp;
+}
+
+/*
+ * Coalescing. A controller value still waiting in the open packet, or in a queued one while the link is congested,
+ * is overwritten in place with a later value for the same channel and controller, and the later message is not
+ * written at all. The value goes out at the earlier message's time. Only controllers that carry a level are
+ * coalesced: bank select, data entry, RPN/NRPN, switches and channel mode messages mean something in sequence.
+ */
+
+static const uint32_t coalescable_controllers[4] = {
+        0xFFFFFFBE, // all but 0 bank select and 6 data entry
+        0xFFFFFFBE, // all but their LSBs 32 and 38
+        0xFFFFFFC0, // all but the 64 - 69 switches
+        0x00FFFFC0, // all but 96 - 101 increment and parameter numbers, and 120 - 127 channel mode
+};
+
+/** Controller of a coalescable message with the current status, -1 if it is not coalescable */
+static inline int16_t coalescable(uint8_t first, const struct processor_t *processor) {
+    switch (processor->status >> 4) {
+        case STATUS_CC_PREF_4:
+            return coalescable_controllers[first >> 5] >> (first & 31) & 1 ? first : -1;
+        case STATUS_CP_AFTERTOUCH_PREF_4:
+        case STATUS_PITCH_BEND_PREF_4:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/** Writes the value into a pending message of the same channel and controller, returns true if there was one */
+static bool coalesce(uint8_t first, uint8_t second, struct processor_t *processor) {
+    const int16_t controller = coalescable(first, processor);
+    if (controller < 0) return false;
+
+    const bool congested = processor->packets_queued > 0
+                           && processor->packets_queued >= processor->coalesce_watermark;
+    for (uint8_t i = 0; i < PROCESSOR_PENDING_MAX; i++) {
+        const struct processor_pending_t *pending = &processor->pending[i];
+        if (pending->status != processor->status || pending->controller != controller) continue;
+
+        const bool open = pending->packet == processor->packet_head;
+        if (!congested && !(open && processor->coalesce == PROCESSOR_COALESCE_ALWAYS)) return false;
+
+        uint8_t *dst = processor->packets[pending->packet].buff + pending->offset;
+        switch (processor->status >> 4) {
+            case STATUS_CC_PREF_4:
+                dst[0] = second;
+                break;
+            case STATUS_PITCH_BEND_PREF_4:
+                dst[0] = first;
+                dst[1] = second;
+                break;
+            default:
+                dst[0] = first;
+        }
+        processor->coalesced_count++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Remembers where the value of the message just written went, a message's value bytes are its last ones. Any other
+ * channel message ends coalescing on its channel, a later value must not move ahead of it.
+ */
+static void track_pending(struct processor_t *processor) {
+    const uint8_t value_len = processor->status >> 4 == STATUS_PITCH_BEND_PREF_4 ? 2 : 1;
+    const int16_t controller = coalescable(processor->buff[processor->buff_len - 2], processor);
+    if (controller < 0) {
+        if (processor->status >= 0xF0) return;
+        for (uint8_t i = 0; i < PROCESSOR_PENDING_MAX; i++) {
+            const uint8_t status = processor->pending[i].status;
+            if (status && (status & 0x0F) == (processor->status & 0x0F)) processor->pending[i].status = 0;
+        }
+        return;
+    }
+
+    uint8_t slot = processor->pending_next;
+    for (uint8_t i = 0; i < PROCESSOR_PENDING_MAX; i++) {
+        if (processor->pending[i].status == processor->status && processor->pending[i].controller == controller) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == processor->pending_next) processor->pending_next = (slot + 1) % PROCESSOR_PENDING_MAX;
+
+    processor->pending[slot].status = processor->status;
+    processor->pending[slot].controller = controller;
+    processor->pending[slot].packet = processor->packet_head;
+    processor->pending[slot].offset = processor->buff_len - value_len;
+}
+
+/**
+ * Runs after every channel and system common message written: tags its arrival for the latency histograms, and marks
+ * the packet when the flush policy wants the message out with the next drain rather than the next tick. The packet is
+ * closed once the chunk is done, so a chord still goes out in one notification.
+ */
+static inline void message_done(int64_t arrival_us, struct processor_t *processor) {
+    COUNT_MESSAGE(processor->status, processor);
+    if (arrival_us != PROCESSOR_ARRIVAL_UNKNOWN && is_timed(processor)) {
+        struct processor_packet_t *packet = &processor->packets[processor->packet_head];
+        if (packet->timed < PROCESSOR_TIMED_MAX) packet->arrival_us[packet->timed++] = arrival_us;
+    }
+    if (processor->urgent_mask & PROCESSOR_URGENT(processor->status)) processor->urgent = true;
+}
+
+static void emit_status(uint8_t first, uint8_t second, uint8_t data_len, uint16_t timestamp,
+                        struct processor_t *processor) {
+    timestamp = packet_order(timestamp, processor);
+    if (processor->mode == PROCESSOR_MODE_COMPACT) {
+        emit_compact(first, second, data_len, timestamp, processor);
+        return;
+    }
+    uint8_t *dst = reserve(2 + data_len, timestamp, processor);
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = processor->status;
+    dst[2] = first;
+    if (data_len == 2) dst[3] = second;
+    processor->packet_status = processor->status < 0xF0 ? processor->status : 0;
+}
+
+static void emit_running(uint8_t first, uint8_t second, uint8_t data_len, uint16_t timestamp,
+                         struct processor_t *processor) {
+    timestamp = packet_order(timestamp, processor);
+    if (processor->mode == PROCESSOR_MODE_COMPACT) {
+        emit_compact(first, second, data_len, timestamp, processor);
+        return;
+    }
+    FLUSH_NOTIFY_IF_EXCEED(1 + data_len, processor);
+    if (processor->packet_status != processor->status) {
+        // the status was not sent in this packet yet, e.g. it was flushed or opened with a real-time byte
+        emit_status(first, second, data_len, timestamp, processor);
+        return;
+    }
+    uint8_t *dst = reserve(1 + data_len, timestamp, processor);
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = first;
+    if (data_len == 2) dst[2] = second;
+}
+
+/** A message the open packet does not simply take, see append: coalescing, a new packet, a gap or compact mode */
+static void emit_message(uint8_t first, uint8_t second, uint8_t data_len, bool running, uint16_t timestamp,
+                         int64_t arrival_us, struct processor_t *processor) {
+    if (processor->coalesce && coalesce(first, second, processor)) {
+        COUNT_MESSAGE(processor->status, processor);
+        return;
+    }
+    if (running) {
+        emit_running(first, second, data_len, timestamp, processor);
+    } else {
+        emit_status(first, second, data_len, timestamp, processor);
+    }
+    if (processor->coalesce) track_pending(processor);
+    message_done(arrival_us, processor);
+}
+
+/**
+ * Where a message of size bytes goes when the open packet takes it as it is: default mode, no coalescing, room left
+ * and no gap or reordering to see to first. Most messages are written right there, NULL sends the rest to
+ * emit_message.
+ */
+static inline uint8_t *append(uint16_t size, uint16_t timestamp, struct processor_t *processor) {
+    uint16_t len = processor->buff_len;
+    if (processor->mode != PROCESSOR_MODE_DEFAULT || processor->coalesce || processor->header_open
+        || len + size + (len == 0) > processor->buff_max) {
+        return NULL;
+    }
+    if (len == 0) {
+        processor->buff[0] = TIMESTAMP_HIGH(timestamp);
+        processor->packet_open_timestamp = timestamp;
+        len = 1;
+    } else if (((timestamp - processor->last_timestamp) & BLE_MIDI_TIMESTAMP_MASK) > 0x7F) {
+        return NULL;
+    }
+    processor->buff_len = len + size;
+    processor->last_timestamp = timestamp;
+    return processor->buff + len;
+}
+
+static inline void emit_1(uint8_t byte, uint16_t timestamp, int64_t arrival_us, struct processor_t *processor) {
+    uint8_t *dst = append(3, timestamp, processor);
+    if (!dst) {
+        emit_message(byte, 0, 1, false, timestamp, arrival_us, processor);
+        return;
+    }
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = processor->status;
+    dst[2] = byte;
+    processor->packet_status = processor->status < 0xF0 ? processor->status : 0;
+    message_done(arrival_us, processor);
+}
+
+static inline void emit_2(uint8_t first, uint8_t second, uint16_t timestamp, int64_t arrival_us,
+                          struct processor_t *processor) {
+    uint8_t *dst = append(4, timestamp, processor);
+    if (!dst) {
+        emit_message(first, second, 2, false, timestamp, arrival_us, processor);
+        return;
+    }
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = processor->status;
+    dst[2] = first;
+    dst[3] = second;
+    processor->packet_status = processor->status < 0xF0 ? processor->status : 0;
+    message_done(arrival_us, processor);
+}
+
+/** Under running status the status byte only goes out again if the packet has not carried it yet */
+static inline void emit_running_1(uint8_t byte, uint16_t timestamp, int64_t arrival_us,
+                                  struct processor_t *processor) {
+    const bool running = processor->packet_status == processor->status;
+    uint8_t *dst = append(3 - running, timestamp, processor);
+    if (!dst) {
+        emit_message(byte, 0, 1, true, timestamp, arrival_us, processor);
+        return;
+    }
+    *dst++ = TIMESTAMP_LOW(timestamp);
+    if (!running) *dst++ = processor->packet_status = processor->status;
+    dst[0] = byte;
+    message_done(arrival_us, processor);
+}
+
+static inline void emit_running_2(uint8_t first, uint8_t second, uint16_t timestamp, int64_t arrival_us,
+                                  struct processor_t *processor) {
+    const bool running = processor->packet_status == processor->status;
+    uint8_t *dst = append(4 - running, timestamp, processor);
+    if (!dst) {
+        emit_message(first, second, 2, true, timestamp, arrival_us, processor);
+        return;
+    }
+    *dst++ = TIMESTAMP_LOW(timestamp);
+    if (!running) *dst++ = processor->packet_status = processor->status;
+    dst[0] = first;
+    dst[1] = second;
+    message_done(arrival_us, processor);
+}
+
+/** Every byte of a machine word with only its high bit set */
+#define WORD_HIGH_BITS ((size_t) -1 / 0xFF * 0x80)
+
+/** Returns the first byte with the high bit set, scanning a machine word at a time */
+static inline const uint8_t *find_status_byte(const uint8_t *src, const uint8_t *end) {
+    while (src < end && ((uintptr_t) src % sizeof(size_t))) {
+        if (*src & 0x80) return src;
+        src++;
+    }
+    while (end - src >= (ptrdiff_t) sizeof(size_t)) {
+        size_t word;
+        memcpy(&word, src, sizeof(size_t));
+        if (word & WORD_HIGH_BITS) break;
+        src += sizeof(size_t);
+    }
+    while (src < end && !(*src & 0x80)) src++;
+    return src;
+}
+
+/** Arrival time of each byte in a chunk, worked out back from the last one */
+struct chunk_clock_t {
+    const uint8_t *start;
+    int64_t start_at_us;
+    uint32_t start_ms;
+    uint32_t start_us; // below start_ms
+    uint16_t byte_us;
+};
+
+static inline int64_t byte_arrival_us(const uint8_t *byte, const struct chunk_clock_t *clock) {
+    return clock->start_at_us + (int64_t) (byte - clock->start) * clock->byte_us;
+}
+
+static inline uint16_t byte_timestamp(const uint8_t *byte, const struct chunk_clock_t *clock) {
+    return (clock->start_ms + (clock->start_us + (uint32_t) (byte - clock->start) * clock->byte_us) / 1000)
+           & BLE_MIDI_TIMESTAMP_MASK;
+}
+
+/*
+ * SysEx streaming. A message of any length passes through the open packet only, nothing beyond it is buffered:
+ *   first packet:        header, timestamp, 0xF0, data...
+ *   continuation packet: header, data...
+ *   last packet:         header, [data...], timestamp, 0xF7
+ * Real-time bytes in between go to the real-time lane, the data continues right after them.
+ */
+
+static void sys_ex_start(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+    COUNT_MESSAGE(0xF0, processor);
+    timestamp = packet_order(timestamp, processor);
+    uint8_t *dst = reserve(3, timestamp, processor);
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = 0xF0;
+    dst[2] = byte;
+    processor->packet_status = 0;
+    processor->packet_timestamp = TIMESTAMP_NONE;
+}
+
+/** Continuation packets start with data right after the header, there is no timestamp byte to go with it yet */
+static inline void open_continuation(uint16_t timestamp, struct processor_t *processor) {
+    SET_HIGH_TIMESTAMP_IF_EMPTY_BUF(timestamp, processor);
+    processor->header_open = true;
+}
+
+static inline void sys_ex_byte(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+    FLUSH_NOTIFY_IF_EXCEED(1, processor);
+    if (processor->buff_len == 0) open_continuation(timestamp, processor);
+    processor->buff[processor->buff_len++] = byte;
+}
+
+/** Copies SysEx data bytes up to the next status byte, returns where the copy stopped */
+static const uint8_t *sys_ex_write(const uint8_t *src, const uint8_t *end, const struct chunk_clock_t *clock,
+                                   struct processor_t *processor) {
+    for (;;) {
+        // a continuation header only goes out with data behind it, a receiver drops a packet that is nothing else
+        if (src == end || *src & 0x80) return src;
+        FLUSH_NOTIFY_IF_EXCEED(1, processor);
+        if (processor->buff_len == 0) open_continuation(byte_timestamp(src, clock), processor);
+        const uint16_t capacity = processor->buff_max - processor->buff_len;
+        const uint8_t *limit = end - src > capacity ? src + capacity : end;
+        const uint8_t *run_end = find_status_byte(src, limit);
+
+        memcpy(processor->buff + processor->buff_len, src, run_end - src);
+        processor->buff_len += run_end - src;
+        if (run_end < limit || run_end == end) return run_end;
+        src = run_end;
+    }
+}
+
+static void sys_ex_end(uint16_t timestamp, struct processor_t *processor) {
+    // the EOX always gets its own timestamp, on a fresh packet that is header, timestamp, 0xF7
+    emit_single(0xF7, timestamp, processor);
+}
+
+static void sys_ex_empty(uint16_t timestamp, struct processor_t *processor) {
+    COUNT_MESSAGE(0xF0, processor);
+    timestamp = packet_order(timestamp, processor);
+    uint8_t *dst = reserve(4, timestamp, processor);
+    dst[0] = TIMESTAMP_LOW(timestamp);
+    dst[1] = 0xF0;
+    dst[2] = TIMESTAMP_LOW(timestamp);
+    dst[3] = 0xF7;
+    processor->packet_status = 0;
+    processor->packet_timestamp = TIMESTAMP_NONE;
+}
+
+/** SysEx, system and real-time actions, out of line so that process_byte stays small enough to inline */
+__attribute__((noinline))
+static void process_action(uint8_t action, uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+    uint8_t transition;
+
+    switch (action) {
+        case ACTION_EMIT_SINGLE:
+            if (is_filtered(byte, processor)) return;
+            COUNT_MESSAGE(byte, processor);
+            emit_single(byte, timestamp, processor);
+            return;
+        case ACTION_SYS_EX_START:
+            sys_ex_start(byte, processor->timestamp, processor);
+            return;
+        case ACTION_SYS_EX_DATA:
+            sys_ex_byte(byte, timestamp, processor);
+            return;
+        case ACTION_SYS_EX_END:
+            sys_ex_end(timestamp, processor);
+            return;
+        case ACTION_SYS_EX_EMPTY:
+            sys_ex_empty(timestamp, processor);
+            return;
+        case ACTION_SYS_EX_INTERRUPT:
+            sys_ex_end(timestamp, processor);
+            // the table sent us to STATE_STATUS, run the status byte from there
+            transition = transitions[STATE_STATUS][byte_classes[byte]];
+            processor->state = T_STATE(transition);
+            if (is_filtered(byte, processor)) {
+                // a dropped status byte still ends SysEx
+                processor->state = STATE_STATUS;
+            } else if (T_ACTION(transition) == ACTION_STATUS) {
+                processor->timestamp = timestamp;
+                processor->status = byte;
+            } else if (T_ACTION(transition) == ACTION_EMIT_SINGLE) {
+                COUNT_MESSAGE(byte, processor);
+                emit_single(byte, timestamp, processor);
+            }
+            return;
+        case ACTION_REALTIME:
+            realtime(byte, timestamp, PROCESSOR_ARRIVAL_UNKNOWN, processor);
+            return;
+        default: // unlikely
+            return;
+    }
+}
+
+/** A byte through the transition table, channel messages are written right here */
+__attribute__((always_inline))
+static inline void process_byte(uint8_t byte, uint16_t timestamp, int64_t arrival_us, struct processor_t *processor) {
+    const uint8_t transition = transitions[processor->state][byte_classes[byte]];
+    processor->state = T_STATE(transition);
+
+    switch (T_ACTION(transition)) {
+        case ACTION_IGNORE:
+            return;
+        case ACTION_STATUS:
+            if (is_filtered(byte, processor)) {
+                // data bytes are ignored until the next status byte, running status included
+                processor->state = STATE_STATUS;
+                return;
+            }
+            processor->timestamp = timestamp;
+            processor->status = byte;
+            return;
+        case ACTION_DATA:
+            processor->first_data_byte = byte;
+            return;
+        case ACTION_RUNNING_DATA:
+            processor->timestamp = timestamp;
+            processor->first_data_byte = byte;
+            return;
+        case ACTION_EMIT_1:
+            emit_1(byte, processor->timestamp, arrival_us, processor);
+            return;
+        case ACTION_EMIT_2:
+            emit_2(processor->first_data_byte, byte, processor->timestamp, arrival_us, processor);
+            return;
+        case ACTION_EMIT_RUNNING_1:
+            emit_running_1(byte, timestamp, arrival_us, processor);
+            return;
+        case ACTION_EMIT_RUNNING_2:
+            emit_running_2(processor->first_data_byte, byte, processor->timestamp, arrival_us, processor);
+            return;
+        default:
+            process_action(T_ACTION(transition), byte, timestamp, processor);
+            return;
+    }
+}
+
+void processor_process_byte(uint8_t byte, uint16_t timestamp, struct processor_t *processor) {
+    process_byte(byte, timestamp, PROCESSOR_ARRIVAL_UNKNOWN, processor);
+    if (processor->urgent) CLOSE_PACKET(PROCESSOR_CLOSE_URGENT, processor);
+}
+
+void processor_process_buffer(const uint8_t *buff, uint16_t len, int64_t end_us, uint16_t byte_us,
+                              struct processor_t *processor) {
+    const uint8_t *end = buff + len;
+    const int64_t start_us = end_us - (int64_t) (len - 1) * byte_us;
+    const struct chunk_clock_t clock = {
+            .start = buff,
+            .start_at_us = start_us,
+            .start_ms = start_us / 1000,
+            .start_us = start_us % 1000,
+            .byte_us = byte_us,
+    };
+
+    processor->chunk_end_us = end_us;
+
+    while (buff < end) {
+        // complete messages and data runs are copied out directly, anything else goes through the table
+        switch (processor->state) {
+            case STATE_RUNNING_1_OF_2:
+                if (end - buff >= 2 && !((buff[0] | buff[1]) & 0x80)) {
+                    emit_running_2(buff[0], buff[1], byte_timestamp(buff, &clock), byte_arrival_us(buff + 1, &clock),
+                                   processor);
+                    buff += 2;
+                    continue;
+                }
+                break;
+            case STATE_RUNNING_1_OF_1:
+                if (!(buff[0] & 0x80)) {
+                    emit_running_1(buff[0], byte_timestamp(buff, &clock), byte_arrival_us(buff, &clock), processor);
+                    buff++;
+                    continue;
+                }
+                break;
+            case STATE_1_OF_2:
+                if (end - buff >= 2 && !((buff[0] | buff[1]) & 0x80)) {
+                    emit_2(buff[0], buff[1], processor->timestamp, byte_arrival_us(buff + 1, &clock), processor);
+                    processor->state = STATE_RUNNING_1_OF_2;
+                    buff += 2;
+                    continue;
+                }
+                break;
+            case STATE_SYS_EX_I_OF_N:
+                buff = sys_ex_write(buff, end, &clock, processor);
+                if (buff == end) continue;
+                break;
+            default:
+                break;
+        }
+        if (*buff >= 0xF8) {
+            // same as the table would do, but with the exact arrival time for the lane statistics
+            realtime(*buff, byte_timestamp(buff, &clock), byte_arrival_us(buff, &clock), processor);
+        } else {
+            process_byte(*buff, byte_timestamp(buff, &clock), byte_arrival_us(buff, &clock), processor);
+        }
+        buff++;
+    }
+    if (processor->urgent) CLOSE_PACKET(PROCESSOR_CLOSE_URGENT, processor);
+}
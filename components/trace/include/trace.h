@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "trace_event.h"
+
+#ifdef CONFIG_MIDI_TRACE
+
+#include "esp_cpu.h"
+
+#define TRACE_RECORDS CONFIG_MIDI_TRACE_RECORDS
+
+_Static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "CONFIG_MIDI_TRACE_RECORDS is a power of two");
+
+/** Written by whatever runs on the core, a record is claimed with an atomic increment so nothing ever waits */
+struct trace_ring_t {
+    uint32_t head; // records ever claimed, the ring holds the last TRACE_RECORDS of them
+    struct trace_record_t records[TRACE_RECORDS];
+};
+
+extern struct trace_ring_t trace_rings[CONFIG_FREERTOS_NUMBER_OF_CORES];
+
+extern volatile bool trace_paused;
+
+/**
+ * A task can move to the other core between reading the core id and the cycle count, the record then lands in the
+ * ring of the core it started on with the other core's cycles. Only unpinned tasks do, and only around a preemption.
+ */
+static inline void trace_record(trace_event event, uint16_t arg) {
+    if (trace_paused) return;
+    struct trace_ring_t *ring = &trace_rings[esp_cpu_get_core_id()];
+    const uint32_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & (TRACE_RECORDS - 1);
+    ring->records[index].cycles = esp_cpu_get_cycle_count();
+    ring->records[index].arg = arg;
+    ring->records[index].event = event;
+}
+
+#define TRACE(event, arg) trace_record(event, arg)
+
+#else
+
+#define TRACE(event, arg) ((void) 0)
+
+#endif
+
+/**
+ * Prints the rings on the console from a task of its own, recording pauses until it is done. See trace_event.h for the
+ * format and bench/trace_decode to turn it into a timeline. Without CONFIG_MIDI_TRACE it prints that tracing is off.
+ */
+void trace_dump(void);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/** What happened, the meaning of the 16 bit argument follows each one */
+typedef enum {
+    TRACE_UART_EVENT = 1, // uart_event_type_t
+    TRACE_UART_READ, // bytes handed to the encoder
+    TRACE_MESSAGE, // status byte of an encoded message
+    TRACE_CLOSE, // processor_close_cause
+    TRACE_DRAIN, // packets queued before the drain
+    TRACE_CONN_TICK, // connection slot
+    TRACE_FLUSH, // bytes in the open packet
+    TRACE_NOTIFY, // ble_notify_result
+    TRACE_NOTIFY_SENT, // bytes the stack took for one connection
+    TRACE_NOTIFY_FAILED, // ble_notify_error
+    TRACE_MTU, // the new MTU
+    TRACE_EVENTS,
+} trace_event;
+
+/** Little endian on the wire, 8 bytes */
+struct trace_record_t {
+    uint32_t cycles; // CPU cycle count of the core that recorded it
+    uint16_t arg;
+    uint8_t event;
+    uint8_t reserved;
+};
+
+/*
+ * trace_dump prints the rings as console lines, anything else on the console in between is to be skipped:
+ *   trace begin <cores> <cpu MHz>
+ *   trace core <core> <cycles> <us> <records>   the core's cycle count and esp_timer time, taken together after
+ *                                               the last record, then the records oldest first
+ *   trace data <hex>                            up to TRACE_LINE_RECORDS records
+ *   trace end
+ */
+#define TRACE_LINE_RECORDS 16
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_ipc.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+
+#ifdef CONFIG_MIDI_TRACE
+
+struct trace_ring_t trace_rings[CONFIG_FREERTOS_NUMBER_OF_CORES];
+
+volatile bool trace_paused;
+
+static volatile bool dumping;
+
+struct anchor_t {
+    uint32_t cycles;
+    int64_t us;
+};
+
+/** Runs on the core the anchor is for, cycle counts of the cores are not in sync */
+static void take_anchor(void *args) {
+    struct anchor_t *anchor = args;
+    anchor->us = esp_timer_get_time();
+    anchor->cycles = esp_cpu_get_cycle_count();
+}
+
+static void dump_ring(uint8_t core) {
+    const struct trace_ring_t *ring = &trace_rings[core];
+    struct anchor_t anchor;
+    const uint32_t head = ring->head;
+    const uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+
+    esp_ipc_call_blocking(core, take_anchor, &anchor);
+    printf("trace core %u %lu %lld %lu\n", core, (unsigned long) anchor.cycles, (long long) anchor.us,
+           (unsigned long) count);
+    for (uint32_t i = 0; i < count; i++) {
+        // the core is little endian like the format, the record goes out as it is in memory
+        const uint8_t *bytes = (const uint8_t *) &ring->records[(head - count + i) & (TRACE_RECORDS - 1)];
+        if (i % TRACE_LINE_RECORDS == 0) printf("%strace data ", i ? "\n" : "");
+        for (uint8_t j = 0; j < sizeof(struct trace_record_t); j++) printf("%02x", bytes[j]);
+    }
+    if (count) printf("\n");
+}
+
+static void dump_task(void *args) {
+    trace_paused = true;
+    // a record claimed just before the pause is written a few instructions later
+    vTaskDelay(1);
+
+    printf("trace begin %u %u\n", CONFIG_FREERTOS_NUMBER_OF_CORES, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    for (uint8_t core = 0; core < CONFIG_FREERTOS_NUMBER_OF_CORES; core++) dump_ring(core);
+    printf("trace end\n");
+
+    memset(trace_rings, 0, sizeof(trace_rings));
+    trace_paused = false;
+    dumping = false;
+    vTaskDelete(NULL);
+}
+
+void trace_dump(void) {
+    if (dumping) return;
+    dumping = true;
+    // the console is slow, whoever asked for the dump does not wait for it
+    if (xTaskCreate(dump_task, "traceDump", 3072, NULL, 1, NULL) != pdPASS) dumping = false;
+}
+
+#else
+
+void trace_dump(void) {
+    printf("trace off, enable CONFIG_MIDI_TRACE\n");
+}
+
+#endif
@@ -1,14 +1,97 @@
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "latency.h"
+
+#define BLE_NOTIFY_MAX_LEN 514 // largest ATT MTU (517) minus the notification header
+
+#define BLE_MIDI_MTU_DEFAULT 23 // ATT MTU of a connection until the exchange
+
+#define BLE_LINK_LL_OCTETS_DEFAULT 27 // LL payload per PDU without data length extension
+
+#define BLE_LINK_LL_OCTETS_MAX 251
+
+#define BLE_LINK_LL_TIME_MAX 2120 // us, 251 octets on the 1M PHY
+
+/** What a notification has to get through, the most constrained of all connections */
+struct ble_link_t {
+    uint16_t mtu;
+    uint16_t ll_octets; // LL payload per PDU the controller sends
+    bool phy_2m; // sending on the LE 2M PHY
+    uint32_t interval_us;
+};
+
+#define BLE_LINK_DEFAULT { \
+    .mtu = BLE_MIDI_MTU_DEFAULT, \
+    .ll_octets = BLE_LINK_LL_OCTETS_DEFAULT, \
+    .phy_2m = false, \
+    .interval_us = 7500, \
+}
+
+#define BLE_NOTIFY_RETRY_COUNT 2
+
+typedef enum {
+    BLE_NOTIFY_SENT,
+    BLE_NOTIFY_QUEUED, // the stack refused it for now, a copy waits in the retry queue
+    BLE_NOTIFY_BUSY, // the retry queue is full, the caller has to hold on to the packet
+    BLE_NOTIFY_DROPPED,
+} ble_notify_result;
+
+typedef enum {
+    BLE_NOTIFY_ERR_NO_CONN,
+    BLE_NOTIFY_ERR_NO_MBUF, // msys pool exhausted
+    BLE_NOTIFY_ERR_ENOMEM,
+    BLE_NOTIFY_ERR_EBUSY,
+    BLE_NOTIFY_ERR_OTHER,
+    BLE_NOTIFY_ERR_OVERFLOW, // the connection's retry queue was full while other connections took the packet
+    BLE_NOTIFY_ERR_TOO_LONG, // the packet was longer than the connection's MTU allows and could not be split
+    BLE_NOTIFY_ERR_COUNT,
+} ble_notify_error;
+
+struct ble_notify_stats_t {
+    uint32_t sent;
+    uint32_t retried; // sent from the retry queue
+    uint32_t failures[BLE_NOTIFY_ERR_COUNT]; // attempts the stack refused, the packet was kept
+    uint32_t drops[BLE_NOTIFY_ERR_COUNT]; // packets lost
+    struct latency_histogram_t latency; // from ble_notify until the stack took the packet, retries included
+};
+
+// totals of every connection so far
+extern struct ble_notify_stats_t ble_notify_stats;
+
 struct ble_midi_args_t {
     char *device_name;
     uint16_t conn_interval_min;
     uint16_t conn_interval_max;
     uint16_t preferred_mtu;
-    void (*conn_interval_change_callback)(uint16_t value);
-    void (*mtu_change_callback)(uint16_t value);
+    void (*conn_interval_change_callback)(uint8_t slot, uint16_t value); // on connect and update, x 1.25ms
+    void (*disconnect_callback)(uint8_t slot);
+    void (*link_change_callback)(const struct ble_link_t *link); // MTU, PHY, data length or interval changed
+    void (*write_callback)(uint8_t slot, const uint8_t *packet, uint16_t len); // a BLE-MIDI packet written by a central
+    uint16_t (*stats_callback)(uint8_t *buff, uint16_t conn_handle); // the stats snapshot, see gatt_stats_callback_t
 };
 
 void ble_midi_start(struct ble_midi_args_t *args);
 
-void ble_notify(uint8_t *byte_buff, uint16_t length);
\ No newline at end of file
+/**
+ * Notifies every subscribed connection. A connection that cannot take the packet right now gets a reference to a
+ * single shared copy in its retry queue. BLE_NOTIFY_BUSY only comes back when no connection has room left. A packet
+ * longer than the smallest connection's MTU allows goes to every connection in pieces that fit, see ble_midi_split.
+ */
+ble_notify_result ble_notify(uint8_t *byte_buff, uint16_t length);
+
+/** Sends what the retry queues hold, oldest first, returns true if a subscribed connection has nothing waiting */
+bool ble_notify_retry(void);
+
+/**
+ * The largest notification value that fills whole LL PDUs and goes out within one connection event, at most the
+ * MTU's. A value that ends a few bytes into another PDU costs that PDU's air time for nothing, one that spans two
+ * events waits an interval for its end.
+ */
+uint16_t ble_link_packet_size(const struct ble_link_t *link);
+
+/** Sends the stats snapshot to every connection subscribed to it and with an MTU large enough to carry it */
+void ble_stats_notify(void);
+
+/** Copies the statistics of the connection in slot, returns false if the slot is free */
+bool ble_conn_stats(uint8_t slot, uint16_t *conn_handle, struct ble_notify_stats_t *stats);
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "processor.h"
+
+#define FILTER_NOTE_OFF (1 << 0)
+#define FILTER_NOTE_ON (1 << 1)
+#define FILTER_POLY_PRESSURE (1 << 2)
+#define FILTER_CONTROL_CHANGE (1 << 3)
+#define FILTER_PROGRAM_CHANGE (1 << 4)
+#define FILTER_CHANNEL_PRESSURE (1 << 5)
+#define FILTER_PITCH_BEND (1 << 6)
+#define FILTER_SYS_EX (1 << 7)
+#define FILTER_TIME_CODE (1 << 8) // 0xF1
+#define FILTER_SONG_POSITION (1 << 9) // 0xF2
+#define FILTER_SONG_SELECT (1 << 10) // 0xF3
+#define FILTER_TUNE_REQUEST (1 << 11) // 0xF6
+#define FILTER_CLOCK (1 << 12) // 0xF8
+#define FILTER_TRANSPORT (1 << 13) // 0xFA, 0xFB, 0xFC
+#define FILTER_ACTIVE_SENSING (1 << 14) // 0xFE
+#define FILTER_RESET (1 << 15) // 0xFF
+#define FILTER_UNDEFINED (1 << 16) // 0xF9, 0xFD, 0xF4 and 0xF5 never get through
+
+/** Which messages to drop before they are encoded */
+struct filter_args_t {
+    uint32_t classes; // FILTER_ bits
+    uint16_t channels; // bit n drops every channel message on channel n + 1
+};
+
+/** Bit per status byte, set for the ones to drop, the processor's filter */
+#define FILTER_BITMAP_WORDS PROCESSOR_FILTER_WORDS
+
+void filter_build(const struct filter_args_t *args, uint32_t bitmap[FILTER_BITMAP_WORDS]);
+
+/** The filter chosen in menuconfig */
+struct filter_args_t filter_kconfig_args(void);
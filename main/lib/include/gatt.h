@@ -1,3 +1,15 @@
+#include <stdint.h>
+
+/** A BLE-MIDI packet written by a central, with or without response */
+typedef void (*gatt_midi_write_callback_t)(uint16_t conn_handle, const uint8_t *packet, uint16_t len);
+
+#define GATT_STATS_MAX_LEN 160
+
+/** Writes the stats snapshot for the connection into buff, GATT_STATS_MAX_LEN long, returns its length */
+typedef uint16_t (*gatt_stats_callback_t)(uint8_t *buff, uint16_t conn_handle);
+
 extern uint16_t gatt_midi_chr_val_handle;
 
-int gatt_midi_init(void);
\ No newline at end of file
+extern uint16_t gatt_stats_chr_val_handle;
+
+int gatt_midi_init(gatt_midi_write_callback_t write_callback, gatt_stats_callback_t stats_callback);
\ No newline at end of file
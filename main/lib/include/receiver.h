@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/uart.h"
+
+#define RECEIVER_QUEUE_BYTES 1024 // MIDI bytes waiting for their time, holds two packets at the largest MTU
+
+#define RECEIVER_QUEUE_MESSAGES 64
+
+struct receiver_stats_t {
+    uint32_t packets;
+    uint32_t malformed;
+    uint32_t late; // messages that came in after their time, written right away
+    uint32_t early; // messages written ahead of their time because the queue was more than half full
+    uint32_t overflow; // messages dropped because the queue was full, the UART could not keep up
+};
+
+extern struct receiver_stats_t receiver_stats;
+
+/**
+ * Plays BLE-MIDI written by a central on the UART. Each message is due at its sender timestamp mapped onto the local
+ * clock, plus playback_delay_us. The delay absorbs connection-interval jitter, one or two intervals are enough.
+ * A task of its own writes the UART, so a central writing faster than the UART drops messages instead of stalling the
+ * BLE host or the timer task.
+ */
+void receiver_start(uart_port_t uart_num, uint32_t playback_delay_us);
+
+/** Decodes and schedules a BLE-MIDI packet written on the connection in slot, called from the BLE host task */
+void receiver_write(uint8_t slot, const uint8_t *packet, uint16_t len);
+
+/** Forgets the clock offset and any open SysEx of the connection in slot, called from the BLE host task */
+void receiver_reset(uint8_t slot);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#define STATS_VERSION 3
+
+#define STATS_INTERVAL_US 1000000 // between notifications to subscribed centrals
+
+/**
+ * Writes the pipeline counters for a central, all little endian, counters since boot:
+ *   u8  STATS_VERSION
+ *   u32 uptime ms
+ *   u32 UART bytes in, u32 UART overflow events
+ *   u32 messages by PROCESSOR_MESSAGE_CLASS, 10 of them
+ *   u32 packets notified, u32 packets the encoder dropped
+ *   u16 average packet fill, per mille of the packet size the link and flush policy allowed when each was closed
+ *   u32 packets closed by processor_close_cause, 4 of them
+ *   u32 notify failures by ble_notify_error, 7 of them, then u32 notify drops the same way
+ *   u32 p50 and u32 p99 us from UART arrival until the stack was handed the packet
+ *   u32 p50 and u32 p99 us the UART interrupt and the scheduler took, 0 without uart_ingestion_t.measure_latency
+ *   u32 lowest free heap bytes so far
+ *   u16 the connection's ATT MTU, u16 its interval x 1.25ms
+ * Returns the length, 159 bytes in this version, a notification needs an MTU of 162.
+ */
+uint16_t stats_snapshot(uint8_t *buff, uint16_t conn_handle);
+
+/** Starts notifying the snapshot every STATS_INTERVAL_US */
+void stats_start(void);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ble_midi.h"
+
+/** Where the transmitter reads the time from, on demand at the point of use */
+struct time_source_t {
+    int64_t (*now_us)(struct time_source_t *time_source);
+};
+
+/** Deterministic time source for host builds, time only moves when told to */
+struct mock_time_source_t {
+    struct time_source_t time_source;
+    int64_t now_us;
+};
+
+extern struct time_source_t esp_timer_time_source;
+
+static inline int64_t time_source_now_us(struct time_source_t *time_source) {
+    return time_source->now_us(time_source);
+}
+
+/** Milliseconds wrap at 8192, computed from the full 64 bit time so the wrap never skips */
+static inline uint16_t time_source_timestamp(int64_t us) {
+    return (uint16_t) ((us / 1000) & BLE_MIDI_TIMESTAMP_MASK);
+}
+
+static inline int64_t mock_time_source_now_us(struct time_source_t *time_source) {
+    return ((struct mock_time_source_t *) time_source)->now_us;
+}
+
+static inline void init_mock_time_source(struct mock_time_source_t *mock, int64_t now_us) {
+    mock->time_source.now_us = mock_time_source_now_us;
+    mock->now_us = now_us;
+}
+
+static inline void mock_time_source_advance(struct mock_time_source_t *mock, int64_t us) {
+    mock->now_us += us;
+}
@@ -1,7 +1,41 @@
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "driver/uart.h"
 
+#include "filter.h"
+#include "processor.h"
+#include "time_source.h"
+#include "uart.h"
+
+/** When a packet that is not full yet leaves, a zeroed policy flushes once every connection interval */
+struct flush_policy_t {
+    uint32_t deadline_us; // longest wait from a packet's first message, checked once every connection interval
+    uint16_t fill_threshold; // packets close at this many bytes, 0 fills them up to the MTU
+    uint16_t urgent_mask; // PROCESSOR_URGENT bits of messages that close their packet with the UART chunk
+};
+
+// every connection interval flushes what arrived before it, notes are handed to the stack as they are played
+#define FLUSH_POLICY_LIVE { \
+    .deadline_us = 0, \
+    .fill_threshold = 0, \
+    .urgent_mask = PROCESSOR_URGENT(0x80) | PROCESSOR_URGENT(0x90), \
+}
+
+// packets wait to fill up for as long as a patch dump or sequence transfer can afford
+#define FLUSH_POLICY_BULK { \
+    .deadline_us = 100000, \
+    .fill_threshold = 0, \
+    .urgent_mask = 0, \
+}
+
+// controller data may share a packet with what follows, note-ons still go right away
+#define FLUSH_POLICY_BALANCED { \
+    .deadline_us = 15000, \
+    .fill_threshold = 0, \
+    .urgent_mask = PROCESSOR_URGENT(0x90), \
+}
+
 struct transmitter_args_t {
     char *device_name;
     uint16_t conn_interval_min;
@@ -9,6 +43,40 @@ struct transmitter_args_t {
     uint16_t preferred_mtu;
     uart_port_t uart_num;
     int rx_pin_num;
+    int tx_pin_num; // MIDI written by a central plays here
+    struct uart_ingestion_t ingestion; // UART_INGESTION_DEFAULT, UART_INGESTION_LOW_LATENCY or custom
+    uint32_t playback_delay_us; // added to the BLE-MIDI timestamps of written MIDI to absorb jitter, see receiver.h
+    bool compact_encoding; // leave out redundant timestamp and status bytes, see PROCESSOR_MODE_COMPACT
+    struct time_source_t *time_source; // esp_timer_time_source if not set
+    struct flush_policy_t flush_policy; // FLUSH_POLICY_LIVE, FLUSH_POLICY_BULK, FLUSH_POLICY_BALANCED or custom
+    struct filter_args_t filter; // messages dropped at ingress, e.g. filter_kconfig_args()
+    processor_coalesce coalesce; // controller values replaced by later ones before they leave
+    uint8_t coalesce_watermark; // packets waiting on the stack from which on the link counts as congested
 };
 
-void transmitter_start(struct transmitter_args_t *args);
\ No newline at end of file
+/** Counted by the transmitter task, plain increments cheap enough to never turn off */
+struct transmitter_stats_t {
+    uint32_t uart_bytes;
+    uint32_t uart_overflows; // FIFO or ring buffer overflows, bytes were lost
+    // with uart_ingestion_t.measure_latency, from the first start bit of a UART_DATA event until the task had it
+    struct latency_histogram_t uart_arrival;
+    // the same less the bytes' wire time and the RX timeout, what the interrupt and the scheduler took
+    struct latency_histogram_t uart_dispatch;
+    struct processor_counters_t processor;
+};
+
+extern struct transmitter_stats_t transmitter_stats;
+
+void transmitter_start(struct transmitter_args_t *args);
+
+/** Replaces the filter, it applies from the next UART read on */
+void transmitter_set_filter(const struct filter_args_t *filter);
+
+/**
+ * Copies the latency histograms of messages from UART arrival until the BLE stack was handed their packet, see
+ * latency_percentile. How long the stack took to accept them is in ble_notify_stats.latency.
+ */
+void transmitter_latency(struct processor_latency_t *latency);
+
+/** latency_percentile of the total, read in place so it needs no copy of the histograms */
+uint32_t transmitter_latency_percentile(uint16_t per_mille);
\ No newline at end of file
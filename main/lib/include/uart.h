@@ -1,3 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+
 #include "driver/uart.h"
 
-void uart_start(uart_port_t uart_num, int rx_pin_num, QueueHandle_t *queue);
\ No newline at end of file
+#define UART_MIDI_BAUD_RATE 31250
+
+#define UART_MIDI_BYTE_US (10 * 1000000 / UART_MIDI_BAUD_RATE) // start bit, 8 data bits, stop bit
+
+#define UART_MIDI_RX_TIMEOUT 10 // idle byte times before a UART_DATA event, the driver's default
+
+#define UART_MIDI_RX_FULL_THRESHOLD 120 // FIFO bytes before a UART_DATA event, the driver's default
+
+#define UART_MIDI_RX_CHUNK 128 // the hardware FIFO size, a UART_DATA event does not carry more
+
+#define UART_MIDI_EVENT_QUEUE 32 // a UART_DATA event per message when the threshold follows the messages
+
+/** When the driver hands received bytes to the transmitter task, a zeroed one keeps the driver's defaults */
+struct uart_ingestion_t {
+    uint8_t rx_timeout; // idle byte times before what the FIFO holds is handed over, 0 is UART_MIDI_RX_TIMEOUT
+    uint8_t rx_full_threshold; // bytes in the FIFO that are handed over right away, 0 is UART_MIDI_RX_FULL_THRESHOLD
+    bool message_threshold; // after every event the threshold is what completes the next message, see below
+    bool measure_latency; // time the first start bit of every event on the RX pin, see uart_first_edge_us
+};
+
+// bytes wait until the FIFO is nearly full or the line idled for 10 byte times, 3.2ms after a lone note-on
+#define UART_INGESTION_DEFAULT { \
+    .rx_timeout = 0, \
+    .rx_full_threshold = 0, \
+    .message_threshold = false, \
+    .measure_latency = false, \
+}
+
+// a message goes as soon as its last byte is in, SysEx is handed over in blocks of rx_full_threshold bytes
+#define UART_INGESTION_LOW_LATENCY { \
+    .rx_timeout = 2, \
+    .rx_full_threshold = 32, \
+    .message_threshold = true, \
+    .measure_latency = true, \
+}
+
+void uart_start(uart_port_t uart_num, int rx_pin_num, int tx_pin_num, const struct uart_ingestion_t *ingestion,
+                QueueHandle_t *queue);
+
+/** The FIFO raises a UART_DATA event once it holds this many bytes, 1 to UART_MIDI_RX_CHUNK - 1 */
+void uart_set_threshold(uint8_t threshold);
+
+/**
+ * With measure_latency, when the first start bit after the last uart_arm_edge arrived on the RX pin in esp_timer time,
+ * 0 if none did. Bytes that came in before the arm are not seen, the time is exact for a message on an idle line.
+ */
+int64_t uart_first_edge_us(void);
+
+/** Waits for the next start bit, called once the bytes of the last UART_DATA event are read */
+void uart_arm_edge(void);
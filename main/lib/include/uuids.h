@@ -4,4 +4,10 @@ extern const ble_uuid128_t gatt_midi_svc_uuid;
 
 extern const ble_uuid128_t gatt_midi_chr_uuid;
 
-extern const ble_uuid16_t gatt_midi_dsc_uuid;
\ No newline at end of file
+extern const ble_uuid16_t gatt_midi_dsc_uuid;
+
+extern const ble_uuid128_t gatt_stats_svc_uuid;
+
+extern const ble_uuid128_t gatt_stats_chr_uuid;
+
+extern const ble_uuid128_t gatt_trace_chr_uuid;
\ No newline at end of file
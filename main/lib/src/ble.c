@@ -1,7 +1,9 @@
 #include <stdarg.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_peripheral.h"
+#include "freertos/FreeRTOS.h"
 #include "host/ble_hs.h"
 #include "nvs_flash.h"
 #include "nimble/nimble_port.h"
@@ -10,18 +12,80 @@
 #include "services/gap/ble_svc_gap.h"
 
 #include "ble.h"
+#include "ble_midi.h"
 #include "gatt.h"
+#include "trace.h"
 #include "uuids.h"
 
 static uint8_t own_addr_type;
-static uint16_t conn_handle;
 static uint16_t itvl_min = 0x06;
 static uint16_t itvl_max = 0x0c;
 uint16_t preferred_mtu = 256;
 
-void (*on_conn_interval_change)(uint16_t value);
+void (*on_conn_interval_change)(uint8_t slot, uint16_t value);
 
-void (*on_mtu_change)(uint16_t value);
+void (*on_disconnect)(uint8_t slot);
+
+void (*on_link_change)(const struct ble_link_t *link);
+
+void (*on_write)(uint8_t slot, const uint8_t *packet, uint16_t len);
+
+uint16_t (*on_stats)(uint8_t *buff, uint16_t conn_handle);
+
+#define MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+/** A packet waiting for a retry, shared by every connection it is queued for */
+struct shared_packet_t {
+    uint8_t buff[BLE_NOTIFY_MAX_LEN];
+    uint16_t len;
+    uint8_t refs;
+    int64_t offered_us; // first handed to ble_notify
+};
+
+struct retry_entry_t {
+    struct shared_packet_t *packet;
+};
+
+// the host task writes the slots under conns_lock, other tasks read the fields they need under it as well
+struct conn_t {
+    uint16_t handle; // BLE_HS_CONN_HANDLE_NONE while the slot is free
+    uint16_t mtu;
+    uint16_t ll_octets;
+    bool phy_2m;
+    uint16_t itvl; // x 1.25ms
+    bool subscribed;
+    bool stats_subscribed;
+    uint32_t generation; // counted up on every connect and disconnect, handles get reused
+    // only written from the task calling ble_notify, see sync_slot, the counters are read without a lock
+    uint32_t synced_generation;
+    struct ble_notify_stats_t stats;
+    struct retry_entry_t retry_queue[BLE_NOTIFY_RETRY_COUNT];
+    uint8_t retry_head;
+    uint8_t retry_count;
+};
+
+static portMUX_TYPE conns_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct conn_t conns[MAX_CONNECTIONS];
+
+// every connection holds at most BLE_NOTIFY_RETRY_COUNT of them, so the pool never runs out
+static struct shared_packet_t shared_packets[BLE_NOTIFY_RETRY_COUNT * MAX_CONNECTIONS];
+
+static struct ble_link_t reported_link;
+
+struct ble_notify_stats_t ble_notify_stats;
+
+/** Counts for the connection and the totals */
+#define COUNT(conn, counter) do { \
+        (conn)->stats.counter++; \
+        ble_notify_stats.counter++; \
+    } while (0)
+
+/** Stack latency of a packet the connection sent, for the connection and the totals */
+#define RECORD_LATENCY(conn, offered_us) do { \
+        const uint32_t latency_us = esp_timer_get_time() - (offered_us); \
+        latency_record(&(conn)->stats.latency, latency_us); \
+        latency_record(&ble_notify_stats.latency, latency_us); \
+    } while (0)
 
 static const char *TAG = "BLE";
 
@@ -73,8 +137,42 @@ static void advertise(void) {
     }
 }
 
+static struct conn_t *find_conn(uint16_t handle) {
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        if (conns[i].handle == handle) return &conns[i];
+    }
+    return NULL;
+}
+
+/** Hands a write on to the callback with the slot of its connection, called from the host task */
+static void midi_write(uint16_t conn_handle, const uint8_t *packet, uint16_t len) {
+    const struct conn_t *conn = find_conn(conn_handle);
+    if (conn && on_write) on_write(conn - conns, packet, len);
+}
+
+/** Packets are sized for the most constrained connection, so one encoding fits every connection */
+static void report_link(void) {
+    struct ble_link_t link = {0};
+    bool connected = false;
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        const struct conn_t *conn = &conns[i];
+        if (conn->handle == BLE_HS_CONN_HANDLE_NONE) continue;
+        if (!connected || conn->mtu < link.mtu) link.mtu = conn->mtu;
+        if (!connected || conn->ll_octets < link.ll_octets) link.ll_octets = conn->ll_octets;
+        if (!connected || conn->itvl * 1250 < link.interval_us) link.interval_us = conn->itvl * 1250;
+        link.phy_2m = (!connected || link.phy_2m) && conn->phy_2m;
+        connected = true;
+    }
+    if (connected && (link.mtu != reported_link.mtu || link.ll_octets != reported_link.ll_octets ||
+                      link.phy_2m != reported_link.phy_2m || link.interval_us != reported_link.interval_us)) {
+        reported_link = link;
+        on_link_change(&link);
+    }
+}
+
 static int gap_callback(struct ble_gap_event *event, void *args) {
     struct ble_gap_conn_desc desc;
+    struct conn_t *conn;
     int rc;
 
     switch (event->type) {
@@ -83,10 +181,25 @@ static int gap_callback(struct ble_gap_event *event, void *args) {
                         event->connect.status == 0 ? "established" : "failed",
                         event->connect.status);
             if (event->connect.status == 0) {
-                conn_handle = event->connect.conn_handle;
-
+                conn = find_conn(BLE_HS_CONN_HANDLE_NONE);
+                assert(conn != NULL);
                 rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
                 assert(rc == 0);
+                const uint16_t mtu = ble_att_mtu(event->connect.conn_handle);
+
+                taskENTER_CRITICAL(&conns_lock);
+                conn->generation++;
+                conn->subscribed = false;
+                conn->stats_subscribed = false;
+                conn->mtu = mtu;
+                conn->ll_octets = BLE_LINK_LL_OCTETS_DEFAULT;
+                conn->phy_2m = false;
+                conn->itvl = desc.conn_itvl;
+                conn->handle = event->connect.conn_handle;
+                taskEXIT_CRITICAL(&conns_lock);
+                report_link();
+                // starts the connection's flush timer
+                on_conn_interval_change(conn - conns, desc.conn_itvl);
 
                 struct ble_gap_upd_params conn_params;
                 conn_params.itvl_min = itvl_min; // x 1.25ms
@@ -96,16 +209,50 @@ static int gap_callback(struct ble_gap_event *event, void *args) {
                 ble_gap_update_params(event->connect.conn_handle, &conn_params);
 
                 rc = ble_att_set_preferred_mtu(preferred_mtu);
+
+                // either is turned down by a peer without support, the connection then stays as it is
+                ble_gap_set_prefered_le_phy(event->connect.conn_handle, BLE_GAP_LE_PHY_2M_MASK,
+                                            BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+                ble_gap_set_data_len(event->connect.conn_handle, BLE_LINK_LL_OCTETS_MAX, BLE_LINK_LL_TIME_MAX);
             }
-            if (event->connect.status != 0) {
+            // keep advertising while there is room for another central
+            if (find_conn(BLE_HS_CONN_HANDLE_NONE) && !ble_gap_adv_active()) {
                 advertise();
             }
             return 0;
 
         case BLE_GAP_EVENT_DISCONNECT:
             MODLOG_DFLT(INFO, "disconnect; reason=%d\n", event->disconnect.reason);
-            conn_handle = 0;
-            advertise();
+            conn = find_conn(event->disconnect.conn.conn_handle);
+            if (conn) {
+                taskENTER_CRITICAL(&conns_lock);
+                conn->generation++;
+                conn->handle = BLE_HS_CONN_HANDLE_NONE;
+                conn->subscribed = false;
+                conn->stats_subscribed = false;
+                taskEXIT_CRITICAL(&conns_lock);
+                on_disconnect(conn - conns);
+                report_link();
+            }
+            if (!ble_gap_adv_active()) {
+                advertise();
+            }
+            return 0;
+
+        case BLE_GAP_EVENT_SUBSCRIBE:
+            MODLOG_DFLT(INFO, "subscribe event; conn_handle=%d attr_handle=%d cur_notify=%d\n",
+                        event->subscribe.conn_handle,
+                        event->subscribe.attr_handle,
+                        event->subscribe.cur_notify);
+            conn = find_conn(event->subscribe.conn_handle);
+            taskENTER_CRITICAL(&conns_lock);
+            if (conn && event->subscribe.attr_handle == gatt_midi_chr_val_handle) {
+                conn->subscribed = event->subscribe.cur_notify;
+            }
+            if (conn && event->subscribe.attr_handle == gatt_stats_chr_val_handle) {
+                conn->stats_subscribed = event->subscribe.cur_notify;
+            }
+            taskEXIT_CRITICAL(&conns_lock);
             return 0;
 
         case BLE_GAP_EVENT_CONN_UPDATE:
@@ -113,9 +260,45 @@ static int gap_callback(struct ble_gap_event *event, void *args) {
                         event->conn_update.status);
             rc = ble_gap_conn_find(event->conn_update.conn_handle, &desc);
             assert(rc == 0);
-            on_conn_interval_change(desc.conn_itvl);
+            conn = find_conn(event->conn_update.conn_handle);
+            if (conn) {
+                taskENTER_CRITICAL(&conns_lock);
+                conn->itvl = desc.conn_itvl;
+                taskEXIT_CRITICAL(&conns_lock);
+                on_conn_interval_change(conn - conns, desc.conn_itvl);
+                report_link();
+            }
+            return 0;
+
+        case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+            MODLOG_DFLT(INFO, "phy update; status=%d tx_phy=%d rx_phy=%d\n",
+                        event->phy_updated.status,
+                        event->phy_updated.tx_phy,
+                        event->phy_updated.rx_phy);
+            conn = find_conn(event->phy_updated.conn_handle);
+            if (conn && event->phy_updated.status == 0) {
+                taskENTER_CRITICAL(&conns_lock);
+                conn->phy_2m = event->phy_updated.tx_phy == BLE_GAP_LE_PHY_2M;
+                taskEXIT_CRITICAL(&conns_lock);
+                report_link();
+            }
             return 0;
 
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+        case BLE_GAP_EVENT_DATA_LEN_CHG:
+            MODLOG_DFLT(INFO, "data length change; max_tx_octets=%d max_rx_octets=%d\n",
+                        event->data_len_chg.max_tx_octets,
+                        event->data_len_chg.max_rx_octets);
+            conn = find_conn(event->data_len_chg.conn_handle);
+            if (conn) {
+                taskENTER_CRITICAL(&conns_lock);
+                conn->ll_octets = event->data_len_chg.max_tx_octets;
+                taskEXIT_CRITICAL(&conns_lock);
+                report_link();
+            }
+            return 0;
+#endif
+
         case BLE_GAP_EVENT_ADV_COMPLETE:
             MODLOG_DFLT(INFO, "advertise complete; reason=%d\n",
                         event->adv_complete.reason);
@@ -135,7 +318,13 @@ static int gap_callback(struct ble_gap_event *event, void *args) {
                         event->mtu.conn_handle,
                         event->mtu.channel_id,
                         event->mtu.value);
-            on_mtu_change(event->mtu.value);
+            conn = find_conn(event->mtu.conn_handle);
+            if (conn) {
+                taskENTER_CRITICAL(&conns_lock);
+                conn->mtu = event->mtu.value;
+                taskEXIT_CRITICAL(&conns_lock);
+                report_link();
+            }
             return 0;
 
         case BLE_GAP_EVENT_REPEAT_PAIRING:
@@ -250,17 +439,293 @@ static void nimble_host_task(void *param) {
     nimble_port_freertos_deinit();
 }
 
-void ble_notify(uint8_t *byte_buff, uint16_t length) {
+static ble_notify_error notify_error(int rc) {
+    switch (rc) {
+        case BLE_HS_ENOMEM:
+            return BLE_NOTIFY_ERR_ENOMEM;
+        case BLE_HS_EBUSY:
+            return BLE_NOTIFY_ERR_EBUSY;
+        case BLE_HS_ENOTCONN:
+            return BLE_NOTIFY_ERR_NO_CONN;
+        default:
+            return BLE_NOTIFY_ERR_OTHER;
+    }
+}
+
+/** Out of buffers or a busy link clears up once the stack sent what it holds, anything else will not */
+static bool is_transient(ble_notify_error error) {
+    return error == BLE_NOTIFY_ERR_NO_MBUF || error == BLE_NOTIFY_ERR_ENOMEM || error == BLE_NOTIFY_ERR_EBUSY;
+}
+
+/**
+ * The mbuf is consumed by the stack whether or not the notification goes out. Every connection needs one of its own:
+ * the stack prepends the ATT and L2CAP headers in place and frees the chain once sent, and msys mbufs carry no
+ * reference count, os_mbuf_dup copies the data just as ble_hs_mbuf_from_flat does.
+ */
+static bool notify(uint16_t handle, const uint8_t *byte_buff, uint16_t length, ble_notify_error *error) {
     struct os_mbuf *om;
+    int rc;
 
-    if (!conn_handle) {
-        return;
+    om = ble_hs_mbuf_from_flat(byte_buff, length);
+    if (!om) {
+        *error = BLE_NOTIFY_ERR_NO_MBUF;
+        TRACE(TRACE_NOTIFY_FAILED, *error);
+        return false;
     }
 
-    om = ble_hs_mbuf_from_flat(byte_buff, length);
-    ble_gatts_notify_custom(conn_handle, gatt_midi_chr_val_handle, om);
+    rc = ble_gatts_notify_custom(handle, gatt_midi_chr_val_handle, om);
+    if (rc != 0) {
+        *error = notify_error(rc);
+        TRACE(TRACE_NOTIFY_FAILED, *error);
+        return false;
+    }
+
+    TRACE(TRACE_NOTIFY_SENT, length);
+    return true;
+}
+
+static uint16_t slot_handle(const struct conn_t *conn) {
+    taskENTER_CRITICAL(&conns_lock);
+    const uint16_t handle = conn->handle;
+    taskEXIT_CRITICAL(&conns_lock);
+    return handle;
+}
+
+static struct shared_packet_t *share(const uint8_t *byte_buff, uint16_t length, int64_t offered_us) {
+    for (uint8_t i = 0; i < sizeof(shared_packets) / sizeof(shared_packets[0]); i++) {
+        if (shared_packets[i].refs) continue;
+        memcpy(shared_packets[i].buff, byte_buff, length);
+        shared_packets[i].len = length;
+        shared_packets[i].offered_us = offered_us;
+        return &shared_packets[i];
+    }
+    return NULL; // unlikely
 }
 
+/**
+ * Catches up with a slot the host task freed or handed to another central since: the previous peer's retry entries
+ * are released unsent and uncounted, and its counters cleared. A reused handle can then never pick up its packets.
+ */
+static void sync_slot(struct conn_t *conn) {
+    taskENTER_CRITICAL(&conns_lock);
+    const uint32_t generation = conn->generation;
+    taskEXIT_CRITICAL(&conns_lock);
+    if (generation == conn->synced_generation) return;
+
+    while (conn->retry_count) {
+        conn->retry_queue[conn->retry_head].packet->refs--;
+        conn->retry_head = (conn->retry_head + 1) % BLE_NOTIFY_RETRY_COUNT;
+        conn->retry_count--;
+    }
+    memset(&conn->stats, 0, sizeof(conn->stats));
+    conn->synced_generation = generation;
+}
+
+/** Sends what the connection's retry queue holds, oldest first, returns true once it is empty */
+static bool retry(struct conn_t *conn) {
+    struct retry_entry_t *entry;
+    ble_notify_error error;
+
+    sync_slot(conn);
+    while (conn->retry_count) {
+        entry = &conn->retry_queue[conn->retry_head];
+        error = BLE_NOTIFY_ERR_NO_CONN;
+        const uint16_t handle = slot_handle(conn);
+        if (handle != BLE_HS_CONN_HANDLE_NONE && notify(handle, entry->packet->buff, entry->packet->len, &error)) {
+            COUNT(conn, sent);
+            COUNT(conn, retried);
+            RECORD_LATENCY(conn, entry->packet->offered_us);
+        } else if (is_transient(error)) {
+            COUNT(conn, failures[error]);
+            return false;
+        } else {
+            COUNT(conn, drops[error]);
+        }
+        entry->packet->refs--;
+        conn->retry_head = (conn->retry_head + 1) % BLE_NOTIFY_RETRY_COUNT;
+        conn->retry_count--;
+    }
+
+    return true;
+}
+
+/** Handle and MTU of the connection in the slot, returns false unless it is subscribed to MIDI */
+static bool subscribed_peer(const struct conn_t *conn, uint16_t *handle, uint16_t *mtu) {
+    taskENTER_CRITICAL(&conns_lock);
+    const bool subscribed = conn->handle != BLE_HS_CONN_HANDLE_NONE && conn->subscribed;
+    *handle = conn->handle;
+    *mtu = conn->mtu;
+    taskEXIT_CRITICAL(&conns_lock);
+    return subscribed;
+}
+
+static inline bool is_subscribed(const struct conn_t *conn) {
+    uint16_t handle;
+    uint16_t mtu;
+    return subscribed_peer(conn, &handle, &mtu);
+}
+
+bool ble_notify_retry(void) {
+    bool ready = false;
+    bool subscribed = false;
+
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        // entries of a closed or reused slot are released on the way
+        const bool empty = retry(&conns[i]);
+        if (!is_subscribed(&conns[i])) continue;
+        subscribed = true;
+        ready |= empty;
+    }
+
+    return ready || !subscribed;
+}
+
+/** A packet on its way to every subscribed connection, whole or in pieces */
+struct fan_out_t {
+    int64_t offered_us;
+    bool queued; // a connection holds a copy in its retry queue
+};
+
+/** Sends the packet to every subscribed connection, or queues it for those that cannot take it right now */
+static void fan_out(const uint8_t *byte_buff, uint16_t length, void *context) {
+    struct fan_out_t *state = context;
+    struct shared_packet_t *shared = NULL;
+    struct retry_entry_t *entry;
+    struct conn_t *conn;
+    ble_notify_error error;
+    uint16_t handle;
+    uint16_t mtu;
+
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        conn = &conns[i];
+        if (!subscribed_peer(conn, &handle, &mtu)) continue;
+
+        // the stack would cut it short, ble_notify only gets here with a packet it could not split
+        if (length > BLE_NOTIFY_MAX_LEN || length + 3 > mtu) {
+            COUNT(conn, drops[BLE_NOTIFY_ERR_TOO_LONG]);
+            continue;
+        }
+
+        // packets waiting for a retry go first, so nothing overtakes them
+        if (conn->retry_count == 0) {
+            if (notify(handle, byte_buff, length, &error)) {
+                COUNT(conn, sent);
+                RECORD_LATENCY(conn, state->offered_us);
+                continue;
+            }
+            if (!is_transient(error)) {
+                COUNT(conn, drops[error]);
+                continue;
+            }
+            COUNT(conn, failures[error]);
+        }
+
+        if (conn->retry_count == BLE_NOTIFY_RETRY_COUNT) {
+            COUNT(conn, drops[BLE_NOTIFY_ERR_OVERFLOW]);
+            continue;
+        }
+
+        if (!shared) shared = share(byte_buff, length, state->offered_us);
+        shared->refs++;
+        entry = &conn->retry_queue[(conn->retry_head + conn->retry_count) % BLE_NOTIFY_RETRY_COUNT];
+        entry->packet = shared;
+        conn->retry_count++;
+        state->queued = true;
+    }
+}
+
+ble_notify_result ble_notify(uint8_t *byte_buff, uint16_t length) {
+    static uint8_t piece[BLE_NOTIFY_MAX_LEN]; // only the task calling ble_notify splits
+    struct fan_out_t state = {.offered_us = esp_timer_get_time()};
+    uint16_t handle;
+    uint16_t mtu;
+    uint16_t smallest = BLE_NOTIFY_MAX_LEN;
+    bool subscribed = false;
+    bool room = false;
+
+    ble_notify_retry();
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        if (!subscribed_peer(&conns[i], &handle, &mtu)) continue;
+        subscribed = true;
+        room |= conns[i].retry_count < BLE_NOTIFY_RETRY_COUNT;
+        if (mtu - 3 < smallest) smallest = mtu - 3;
+    }
+    if (!subscribed) {
+        ble_notify_stats.drops[BLE_NOTIFY_ERR_NO_CONN]++;
+        return BLE_NOTIFY_DROPPED;
+    }
+    if (!room) {
+        // held back only if no connection has room, a single slow central must not stall the others
+        return BLE_NOTIFY_BUSY;
+    }
+
+    // a connection joined with a smaller MTU than the packet was sized for, until report_link has resized the
+    // encoder every connection gets the packet in pieces that fit the smallest, a SysEx in progress goes on whole
+    if (length <= smallest || !ble_midi_split(byte_buff, length, smallest, piece, fan_out, &state)) {
+        fan_out(byte_buff, length, &state);
+    }
+
+    return state.queued ? BLE_NOTIFY_QUEUED : BLE_NOTIFY_SENT;
+}
+
+void ble_stats_notify(void) {
+    static uint8_t snapshot[GATT_STATS_MAX_LEN]; // only the stats timer calls this
+
+    if (!on_stats) return;
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        taskENTER_CRITICAL(&conns_lock);
+        const uint16_t handle = conns[i].handle;
+        const bool subscribed = conns[i].stats_subscribed;
+        taskEXIT_CRITICAL(&conns_lock);
+        if (handle == BLE_HS_CONN_HANDLE_NONE || !subscribed) continue;
+
+        const uint16_t len = on_stats(snapshot, handle);
+        // a notification that does not fit would be cut short, the central can still read the whole snapshot
+        if (len + 3 > ble_att_mtu(handle)) continue;
+        struct os_mbuf *om = ble_hs_mbuf_from_flat(snapshot, len);
+        if (om) ble_gatts_notify_custom(handle, gatt_stats_chr_val_handle, om);
+    }
+}
+
+// L2CAP header and the notification's ATT header, ahead of the value
+#define LL_NOTIFY_OVERHEAD (4 + 3)
+
+/** Air time of a PDU carrying octets and the peer's empty reply, each after an inter frame space */
+static uint32_t pdu_exchange_us(uint16_t octets, bool phy_2m) {
+    const uint8_t preamble = phy_2m ? 2 : 1;
+    // preamble, access address, header, payload, CRC
+    const uint32_t bits = (preamble + 4 + 2 + octets + 3) * 8 + (preamble + 4 + 2 + 3) * 8;
+    return bits / (phy_2m ? 2 : 1) + 2 * 150;
+}
+
+uint16_t ble_link_packet_size(const struct ble_link_t *link) {
+    const uint16_t att_max = link->mtu - 3;
+    const uint16_t pdus = (att_max + LL_NOTIFY_OVERHEAD) / link->ll_octets;
+    if (pdus == 0) return att_max;
+
+    const uint32_t event_pdus = link->interval_us / pdu_exchange_us(link->ll_octets, link->phy_2m);
+    const uint16_t size = (pdus < event_pdus ? pdus : event_pdus ? event_pdus : 1) * link->ll_octets
+                          - LL_NOTIFY_OVERHEAD;
+    return size < att_max ? size : att_max;
+}
+
+bool ble_conn_stats(uint8_t slot, uint16_t *conn_handle, struct ble_notify_stats_t *stats) {
+    if (slot >= MAX_CONNECTIONS) return false;
+    taskENTER_CRITICAL(&conns_lock);
+    *conn_handle = conns[slot].handle;
+    const bool synced = conns[slot].generation == conns[slot].synced_generation;
+    taskEXIT_CRITICAL(&conns_lock);
+    if (*conn_handle == BLE_HS_CONN_HANDLE_NONE) return false;
+
+    // the counters are only ever counted up by the notify task, a copy taken mid-update is at most a packet off
+    if (synced) {
+        *stats = conns[slot].stats;
+    } else {
+        // the notify task has yet to clear the previous peer's counters
+        memset(stats, 0, sizeof(*stats));
+    }
+    return true;
+}
 
 void ble_midi_start(struct ble_midi_args_t *args) {
     int rc;
@@ -269,7 +734,14 @@ void ble_midi_start(struct ble_midi_args_t *args) {
     if (args->conn_interval_max) itvl_max = args->conn_interval_max;
     if (args->preferred_mtu) preferred_mtu = args->preferred_mtu;
     on_conn_interval_change = args->conn_interval_change_callback;
-    on_mtu_change = args->mtu_change_callback;
+    on_disconnect = args->disconnect_callback;
+    on_link_change = args->link_change_callback;
+    on_write = args->write_callback;
+    on_stats = args->stats_callback;
+
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        conns[i].handle = BLE_HS_CONN_HANDLE_NONE;
+    }
 
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -290,7 +762,7 @@ void ble_midi_start(struct ble_midi_args_t *args) {
     ble_hs_cfg.sm_io_cap = CONFIG_EXAMPLE_IO_TYPE;
     ble_hs_cfg.sm_sc = 0;
 
-    rc = gatt_midi_init();
+    rc = gatt_midi_init(midi_write, args->stats_callback);
     assert(rc == 0);
 
     rc = ble_svc_gap_device_name_set(args->device_name);
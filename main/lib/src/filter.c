@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "filter.h"
+
+static void drop(uint8_t status, uint32_t bitmap[FILTER_BITMAP_WORDS]) {
+    bitmap[status >> 5] |= 1u << (status & 31);
+}
+
+/** Status bytes of each FILTER_ class, indexed by bit position, 0 ends a list */
+static const uint8_t class_statuses[][3] = {
+        {0x80},
+        {0x90},
+        {0xA0},
+        {0xB0},
+        {0xC0},
+        {0xD0},
+        {0xE0},
+        {0xF0},
+        {0xF1},
+        {0xF2},
+        {0xF3},
+        {0xF6},
+        {0xF8},
+        {0xFA, 0xFB, 0xFC},
+        {0xFE},
+        {0xFF},
+        {0xF9, 0xFD},
+};
+
+void filter_build(const struct filter_args_t *args, uint32_t bitmap[FILTER_BITMAP_WORDS]) {
+    memset(bitmap, 0, sizeof(uint32_t) * FILTER_BITMAP_WORDS);
+
+    for (uint8_t i = 0; i < sizeof(class_statuses) / sizeof(class_statuses[0]); i++) {
+        if (!(args->classes & (1u << i))) continue;
+        for (uint8_t j = 0; j < sizeof(class_statuses[i]) && class_statuses[i][j]; j++) {
+            const uint8_t status = class_statuses[i][j];
+            if (status >= 0xF0) {
+                drop(status, bitmap);
+                continue;
+            }
+            for (uint8_t channel = 0; channel < 16; channel++) drop(status | channel, bitmap);
+        }
+    }
+
+    for (uint8_t channel = 0; channel < 16; channel++) {
+        if (!(args->channels & (1u << channel))) continue;
+        for (uint8_t status = 0x80; status < 0xF0; status += 0x10) drop(status | channel, bitmap);
+    }
+}
+
+struct filter_args_t filter_kconfig_args(void) {
+    struct filter_args_t args = {
+            .classes = 0,
+            .channels = CONFIG_MIDI_FILTER_CHANNELS,
+    };
+#ifdef CONFIG_MIDI_FILTER_ACTIVE_SENSING
+    args.classes |= FILTER_ACTIVE_SENSING;
+#endif
+#ifdef CONFIG_MIDI_FILTER_UNDEFINED
+    args.classes |= FILTER_UNDEFINED;
+#endif
+#ifdef CONFIG_MIDI_FILTER_CLOCK
+    args.classes |= FILTER_CLOCK;
+#endif
+#ifdef CONFIG_MIDI_FILTER_SYS_EX
+    args.classes |= FILTER_SYS_EX;
+#endif
+#ifdef CONFIG_MIDI_FILTER_POLY_PRESSURE
+    args.classes |= FILTER_POLY_PRESSURE;
+#endif
+#ifdef CONFIG_MIDI_FILTER_CHANNEL_PRESSURE
+    args.classes |= FILTER_CHANNEL_PRESSURE;
+#endif
+    return args;
+}
@@ -8,12 +8,21 @@
 #include "services/ans/ble_svc_ans.h"
 #include "services/gatt/ble_svc_gatt.h"
 
+#include "ble.h"
 #include "gatt.h"
+#include "trace.h"
 #include "uuids.h"
 
-static uint8_t gatt_midi_chr_val;
 uint16_t gatt_midi_chr_val_handle;
 static uint8_t gatt_midi_dsc_val;
+static uint8_t gatt_midi_packet[BLE_NOTIFY_MAX_LEN]; // only the host task writes
+static gatt_midi_write_callback_t on_midi_write;
+uint16_t gatt_stats_chr_val_handle;
+static uint8_t gatt_stats_snapshot[GATT_STATS_MAX_LEN]; // only the host task reads
+static gatt_stats_callback_t on_stats_read;
+#ifdef CONFIG_MIDI_TRACE
+static uint16_t gatt_trace_chr_val_handle;
+#endif
 
 static int gatt_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len, void *dst, uint16_t *len) {
     uint16_t om_len;
@@ -40,7 +49,12 @@ static int gatt_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct bl
         case BLE_GATT_ACCESS_OP_READ_CHR:
             uuid = ctxt->chr->uuid;
             if (attr_handle == gatt_midi_chr_val_handle) {
-                rc = os_mbuf_append(ctxt->om, &gatt_midi_chr_val, sizeof(gatt_midi_chr_val));
+                // BLE-MIDI reads return no payload
+                return 0;
+            }
+            if (attr_handle == gatt_stats_chr_val_handle) {
+                const uint16_t len = on_stats_read ? on_stats_read(gatt_stats_snapshot, conn_handle) : 0;
+                rc = os_mbuf_append(ctxt->om, gatt_stats_snapshot, len);
                 return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
             }
             goto unknown;
@@ -48,11 +62,18 @@ static int gatt_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct bl
         case BLE_GATT_ACCESS_OP_WRITE_CHR:
             uuid = ctxt->chr->uuid;
             if (attr_handle == gatt_midi_chr_val_handle) {
-                rc = gatt_write(ctxt->om, sizeof(gatt_midi_chr_val), sizeof(gatt_midi_chr_val), &gatt_midi_chr_val,
-                                    NULL);
-                ble_gatts_chr_updated(attr_handle);
+                uint16_t len;
+                rc = gatt_write(ctxt->om, 1, sizeof(gatt_midi_packet), gatt_midi_packet, &len);
+                if (rc == 0 && on_midi_write) on_midi_write(conn_handle, gatt_midi_packet, len);
                 return rc;
             }
+#ifdef CONFIG_MIDI_TRACE
+            if (attr_handle == gatt_trace_chr_val_handle) {
+                // any value prints the trace rings on the console
+                trace_dump();
+                return 0;
+            }
+#endif
             goto unknown;
 
         case BLE_GATT_ACCESS_OP_READ_DSC:
@@ -88,7 +109,8 @@ static const struct ble_gatt_svc_def gatt_svcs[] = {
                                  /*** This characteristic can be subscribed to by writing 0x00 and 0x01 to the CCCD ***/
                                  .uuid = &gatt_midi_chr_uuid.u,
                                  .access_cb = gatt_svc_access,
-                                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+                                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                                          BLE_GATT_CHR_F_NOTIFY,
                                  .val_handle = &gatt_midi_chr_val_handle,
                                  .descriptors = (struct ble_gatt_dsc_def[])
                                          {{
@@ -107,14 +129,42 @@ static const struct ble_gatt_svc_def gatt_svcs[] = {
                         },
         },
 
+        {
+                /*** Pipeline counters, see stats.h for the layout, with CONFIG_MIDI_TRACE the trace dump too ***/
+                .type = BLE_GATT_SVC_TYPE_PRIMARY,
+                .uuid = &gatt_stats_svc_uuid.u,
+                .characteristics = (struct ble_gatt_chr_def[])
+                        {{
+                                 .uuid = &gatt_stats_chr_uuid.u,
+                                 .access_cb = gatt_svc_access,
+                                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                                 .val_handle = &gatt_stats_chr_val_handle,
+                         },
+#ifdef CONFIG_MIDI_TRACE
+                         {
+                                 .uuid = &gatt_trace_chr_uuid.u,
+                                 .access_cb = gatt_svc_access,
+                                 .flags = BLE_GATT_CHR_F_WRITE,
+                                 .val_handle = &gatt_trace_chr_val_handle,
+                         },
+#endif
+                         {
+                                 0, /* No more characteristics in this service. */
+                         }
+                        },
+        },
+
         {
                 0, /* No more services. */
         },
 };
 
-int gatt_midi_init(void) {
+int gatt_midi_init(gatt_midi_write_callback_t write_callback, gatt_stats_callback_t stats_callback) {
     int rc;
 
+    on_midi_write = write_callback;
+    on_stats_read = stats_callback;
+
     ble_svc_gap_init();
     ble_svc_gatt_init();
 
@@ -0,0 +1,234 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ble.h"
+#include "ble_midi.h"
+#include "decoder.h"
+#include "receiver.h"
+
+#define TIMESTAMP_HALF_US (4096 * 1000)
+
+// the clock offset only ever jumps down, to the fastest packet yet, and creeps up this much per packet for drift
+#define OFFSET_CREEP_US 10
+
+// an offset this far off means the sender's clock restarted, or a gap too long to unwrap
+#define OFFSET_RESYNC_US 1000000
+
+// a message this much past its time counts as late
+#define LATE_US 1000
+
+static const char *TAG = "RECEIVER";
+
+struct scheduled_t {
+    int64_t due_us;
+    uint16_t start; // in queue_bytes
+    uint16_t len;
+};
+
+// one per connection, a central's clock and running SysEx say nothing about another's
+struct peer_t {
+    struct decoder_t decoder;
+    bool synced;
+    int64_t offset_us; // local time minus sender time
+};
+
+struct receiver_stats_t receiver_stats;
+
+static uart_port_t uart_num;
+static uint32_t playback_delay_us;
+static esp_timer_handle_t play_timer;
+
+// the queue is filled from the BLE host task and played from the play task
+static portMUX_TYPE queue_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t queue_bytes[RECEIVER_QUEUE_BYTES];
+static uint16_t bytes_head;
+static uint16_t bytes_used;
+static struct scheduled_t queue[RECEIVER_QUEUE_MESSAGES];
+static uint8_t queue_head;
+static uint8_t queue_count;
+static int64_t last_due_us;
+
+// only the play task writes the UART, it may block there until the TX ring has room, the host and timer tasks never do
+static TaskHandle_t play_task;
+static uint8_t play_buff[BLE_NOTIFY_MAX_LEN];
+static uint8_t uart_status; // running status on the UART
+
+// only touched from the BLE host task
+static struct peer_t peers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static int64_t arrival_us; // of the packet being decoded
+
+static void play_timer_callback(void *args);
+
+static void play_task_main(void *args);
+
+static void schedule(const uint8_t *bytes, uint16_t len, uint16_t timestamp, void *context);
+
+void receiver_start(uart_port_t port, uint32_t delay_us) {
+    uart_num = port;
+    playback_delay_us = delay_us;
+    for (uint8_t slot = 0; slot < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; slot++) {
+        receiver_reset(slot);
+    }
+
+    const esp_timer_create_args_t play_timer_args = {
+            .callback = &play_timer_callback,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&play_timer_args, &play_timer));
+
+    xTaskCreatePinnedToCore(play_task_main, "receiverTask", 2048, NULL, 1, &play_task, 0);
+}
+
+/** Maps a 13 bit sender timestamp onto the local clock, the local clock tells which wrap of the 8192ms it is in */
+static int64_t due_time(struct peer_t *peer, uint16_t timestamp) {
+    if (!peer->synced) {
+        peer->offset_us = arrival_us - timestamp * 1000;
+        peer->synced = true;
+    }
+
+    const int64_t expected_us = arrival_us - peer->offset_us;
+    const int64_t expected_ms = expected_us / 1000;
+    int64_t delta_ms = (timestamp - expected_ms) & BLE_MIDI_TIMESTAMP_MASK;
+    if (delta_ms * 1000 >= TIMESTAMP_HALF_US) delta_ms -= BLE_MIDI_TIMESTAMP_MASK + 1;
+    const int64_t sender_us = (expected_ms + delta_ms) * 1000;
+
+    const int64_t sample_us = arrival_us - sender_us;
+    const int64_t drift_us = sample_us - peer->offset_us;
+    if (drift_us < 0 || drift_us > OFFSET_RESYNC_US) {
+        peer->offset_us = sample_us;
+    } else {
+        peer->offset_us += drift_us < OFFSET_CREEP_US ? drift_us : OFFSET_CREEP_US;
+    }
+
+    return sender_us + peer->offset_us + playback_delay_us;
+}
+
+static bool push(const uint8_t *bytes, uint16_t len, int64_t due_us) {
+    bool pushed = false;
+
+    taskENTER_CRITICAL(&queue_lock);
+    if (queue_count < RECEIVER_QUEUE_MESSAGES && bytes_used + len <= RECEIVER_QUEUE_BYTES) {
+        struct scheduled_t *message = &queue[(queue_head + queue_count) % RECEIVER_QUEUE_MESSAGES];
+        message->start = (bytes_head + bytes_used) % RECEIVER_QUEUE_BYTES;
+        message->len = len;
+        // messages keep their order, a late one holds back the ones after it
+        message->due_us = due_us > last_due_us ? due_us : last_due_us;
+        last_due_us = message->due_us;
+        for (uint16_t i = 0; i < len; i++) {
+            queue_bytes[(message->start + i) % RECEIVER_QUEUE_BYTES] = bytes[i];
+        }
+        bytes_used += len;
+        queue_count++;
+        pushed = true;
+    }
+    taskEXIT_CRITICAL(&queue_lock);
+
+    return pushed;
+}
+
+/** Whether more than half the queue is taken, called under queue_lock */
+static inline bool filling(void) {
+    return queue_count > RECEIVER_QUEUE_MESSAGES / 2 || bytes_used > RECEIVER_QUEUE_BYTES / 2;
+}
+
+/**
+ * Takes the oldest message off the queue if it is due by until_us, or at once while the queue is more than half full,
+ * returns its length or 0
+ */
+static uint16_t pop(int64_t until_us, int64_t *due_us) {
+    uint16_t len = 0;
+
+    taskENTER_CRITICAL(&queue_lock);
+    if (queue_count > 0 && (queue[queue_head].due_us <= until_us || filling())) {
+        const struct scheduled_t *message = &queue[queue_head];
+        for (uint16_t i = 0; i < message->len; i++) {
+            play_buff[i] = queue_bytes[(message->start + i) % RECEIVER_QUEUE_BYTES];
+        }
+        len = message->len;
+        *due_us = message->due_us;
+        bytes_head = (bytes_head + len) % RECEIVER_QUEUE_BYTES;
+        bytes_used -= len;
+        queue_head = (queue_head + 1) % RECEIVER_QUEUE_MESSAGES;
+        queue_count--;
+    }
+    taskEXIT_CRITICAL(&queue_lock);
+
+    return len;
+}
+
+/** Writes the messages due by until_us, leaving out status bytes the UART's running status covers */
+static void play(int64_t until_us) {
+    const uint8_t *bytes;
+    uint16_t len;
+    int64_t due_us;
+
+    while ((len = pop(until_us, &due_us))) {
+        const int64_t now_us = esp_timer_get_time();
+        if (now_us - due_us > LATE_US) receiver_stats.late++;
+        if (due_us > now_us) receiver_stats.early++;
+
+        bytes = play_buff;
+        if (bytes[0] >= 0x80 && bytes[0] < 0xF0) {
+            if (bytes[0] == uart_status) {
+                bytes++;
+                len--;
+            }
+            uart_status = play_buff[0];
+        } else if (bytes[0] >= 0xF0 && bytes[0] < 0xF8) {
+            // system common and SysEx cancel running status, real-time bytes and SysEx data leave it alone
+            uart_status = 0;
+        }
+        uart_write_bytes(uart_num, bytes, len);
+    }
+}
+
+static void arm_play_timer(void) {
+    int64_t due_us = -1;
+
+    taskENTER_CRITICAL(&queue_lock);
+    if (queue_count > 0) due_us = queue[queue_head].due_us;
+    taskEXIT_CRITICAL(&queue_lock);
+    if (due_us < 0) return;
+
+    const int64_t wait_us = due_us - esp_timer_get_time();
+    // the timer may be pending for a later message, or already fired
+    esp_timer_stop(play_timer);
+    esp_timer_start_once(play_timer, wait_us > 0 ? wait_us : 0);
+}
+
+static void play_timer_callback(void *args) {
+    xTaskNotifyGive(play_task);
+}
+
+static void play_task_main(void *args) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        play(esp_timer_get_time());
+        arm_play_timer();
+    }
+}
+
+static void schedule(const uint8_t *bytes, uint16_t len, uint16_t timestamp, void *context) {
+    // the play task is stuck behind a full TX ring, the host task drops the message rather than wait for it
+    if (!push(bytes, len, due_time(context, timestamp))) receiver_stats.overflow++;
+}
+
+void receiver_write(uint8_t slot, const uint8_t *packet, uint16_t len) {
+    arrival_us = esp_timer_get_time();
+    receiver_stats.packets++;
+    if (!decoder_decode(packet, len, &peers[slot].decoder)) {
+        receiver_stats.malformed++;
+        ESP_LOGW(TAG, "malformed packet");
+        ESP_LOG_BUFFER_HEX(TAG, packet, len);
+    }
+    // the play task plays what is due, rearms the timer, and makes room if the queue is filling
+    xTaskNotifyGive(play_task);
+}
+
+void receiver_reset(uint8_t slot) {
+    struct peer_t *peer = &peers[slot];
+    init_decoder(&peer->decoder, schedule, peer);
+    peer->synced = false;
+    peer->offset_us = 0;
+}
@@ -0,0 +1,68 @@
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+
+#include "ble.h"
+#include "stats.h"
+#include "transmitter.h"
+
+static esp_timer_handle_t stats_timer;
+
+static uint8_t *put_u16(uint8_t *buff, uint16_t value) {
+    buff[0] = value & 0xFF;
+    buff[1] = value >> 8;
+    return buff + 2;
+}
+
+static uint8_t *put_u32(uint8_t *buff, uint32_t value) {
+    buff[0] = value & 0xFF;
+    buff[1] = (value >> 8) & 0xFF;
+    buff[2] = (value >> 16) & 0xFF;
+    buff[3] = value >> 24;
+    return buff + 4;
+}
+
+static uint8_t *put_u32s(uint8_t *buff, const uint32_t *values, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) buff = put_u32(buff, values[i]);
+    return buff;
+}
+
+uint16_t stats_snapshot(uint8_t *buff, uint16_t conn_handle) {
+    // the counters are only ever counted up by other tasks, a snapshot taken mid-update is at most an event off
+    const struct processor_counters_t *processor = &transmitter_stats.processor;
+    const uint64_t room = processor->packet_room;
+    struct ble_gap_conn_desc desc;
+    uint8_t *end = buff;
+
+    *end++ = STATS_VERSION;
+    end = put_u32(end, esp_timer_get_time() / 1000);
+    end = put_u32(end, transmitter_stats.uart_bytes);
+    end = put_u32(end, transmitter_stats.uart_overflows);
+    end = put_u32s(end, processor->messages, PROCESSOR_MESSAGE_CLASSES);
+    end = put_u32(end, ble_notify_stats.sent);
+    end = put_u32(end, processor->dropped);
+    end = put_u16(end, room ? processor->packet_bytes * 1000 / room : 0);
+    end = put_u32s(end, processor->closes, PROCESSOR_CLOSE_CAUSES);
+    end = put_u32s(end, ble_notify_stats.failures, BLE_NOTIFY_ERR_COUNT);
+    end = put_u32s(end, ble_notify_stats.drops, BLE_NOTIFY_ERR_COUNT);
+    end = put_u32(end, transmitter_latency_percentile(500));
+    end = put_u32(end, transmitter_latency_percentile(990));
+    end = put_u32(end, latency_percentile(&transmitter_stats.uart_dispatch, 500));
+    end = put_u32(end, latency_percentile(&transmitter_stats.uart_dispatch, 990));
+    end = put_u32(end, esp_get_minimum_free_heap_size());
+    end = put_u16(end, ble_att_mtu(conn_handle));
+    end = put_u16(end, ble_gap_conn_find(conn_handle, &desc) == 0 ? desc.conn_itvl : 0);
+    return end - buff;
+}
+
+static void stats_timer_callback(void *args) {
+    ble_stats_notify();
+}
+
+void stats_start(void) {
+    const esp_timer_create_args_t stats_timer_args = {
+            .callback = &stats_timer_callback,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&stats_timer_args, &stats_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(stats_timer, STATS_INTERVAL_US));
+}
@@ -0,0 +1,11 @@
+#include "esp_timer.h"
+
+#include "time_source.h"
+
+static int64_t esp_timer_now_us(struct time_source_t *time_source) {
+    return esp_timer_get_time();
+}
+
+struct time_source_t esp_timer_time_source = {
+        .now_us = esp_timer_now_us,
+};
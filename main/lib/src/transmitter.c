@@ -1,39 +1,66 @@
+#include <inttypes.h>
 #include <string.h>
 
 #include "driver/uart.h"
+#include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 
 #include "ble.h"
 #include "parser.h"
+#include "receiver.h"
+#include "stats.h"
 #include "uart.h"
 
 #include "processor.h"
+#include "time_source.h"
+#include "trace.h"
 #include "transmitter.h"
 
 static const char *TAG = "TRANSMITTER";
 
 QueueHandle_t uart_queue;
 QueueHandle_t conn_tick_queue;
-QueueHandle_t mtu_change_queue;
+QueueHandle_t link_change_queue;
+QueueHandle_t filter_queue;
 QueueSetHandle_t queue_set;
 
 TaskHandle_t uart_task;
-esp_timer_handle_t ms_timer;
-esp_timer_handle_t conn_interval_timer;
+
+/**
+ * Every connection flushes once per its interval on a periodic timer. The NimBLE host sees no connection events, and
+ * NOTIFY_TX only tells the controller took a notification, so the timer has no phase to lock to and runs free against
+ * the controller's events, a flushed packet may wait up to an interval for the next one.
+ */
+struct conn_timing_t {
+    esp_timer_handle_t timer;
+    uint32_t interval_us;
+};
+
+static portMUX_TYPE conn_timing_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct conn_timing_t conn_timings[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
 
 uart_port_t uart_num;
-int32_t timestamp;
+static uint8_t rx_buff[UART_MIDI_RX_CHUNK]; // UART bytes are encoded straight from here, nothing is allocated per event
+processor_mode encoding_mode;
+struct time_source_t *time_source;
+struct flush_policy_t flush_policy;
+struct filter_args_t filter_args;
+processor_coalesce coalesce;
+uint8_t coalesce_watermark;
+struct uart_ingestion_t ingestion;
+uint8_t rx_timeout;
+static struct processor_latency_t processor_latency;
+static struct processor_t processor; // holds its packets, too large for the task's stack
+struct transmitter_stats_t transmitter_stats;
 
 void connect_callback(void);
 
-void disconnect_callback(void);
-
-void conn_interval_change_callback(uint16_t value);
+void disconnect_callback(uint8_t slot);
 
-void mtu_change_callback(uint16_t value);
+void conn_interval_change_callback(uint8_t slot, uint16_t value);
 
-static void ms_timer_callback(void *args);
+void link_change_callback(const struct ble_link_t *link);
 
 static void conn_interval_timer_callback(void *args);
 
@@ -41,6 +68,18 @@ void transmitter_task(void *args);
 
 void transmitter_start(struct transmitter_args_t *args) {
     uart_num = args->uart_num;
+    encoding_mode = args->compact_encoding ? PROCESSOR_MODE_COMPACT : PROCESSOR_MODE_DEFAULT;
+    time_source = args->time_source ? args->time_source : &esp_timer_time_source;
+    flush_policy = args->flush_policy;
+    filter_args = args->filter;
+    coalesce = args->coalesce;
+    coalesce_watermark = args->coalesce_watermark;
+    ingestion = args->ingestion;
+    rx_timeout = ingestion.rx_timeout ? ingestion.rx_timeout : UART_MIDI_RX_TIMEOUT;
+
+    uart_start(uart_num, args->rx_pin_num, args->tx_pin_num, &ingestion, &uart_queue);
+    // written MIDI can come in as soon as a central connects
+    receiver_start(uart_num, args->playback_delay_us);
 
     struct ble_midi_args_t ble_midi_start_args = {
             .device_name = args->device_name,
@@ -48,86 +87,201 @@ void transmitter_start(struct transmitter_args_t *args) {
             .conn_interval_max = args->conn_interval_max,
             .preferred_mtu = args->preferred_mtu,
             .conn_interval_change_callback = &conn_interval_change_callback,
-            .mtu_change_callback = &mtu_change_callback
+            .disconnect_callback = &disconnect_callback,
+            .link_change_callback = &link_change_callback,
+            .write_callback = &receiver_write,
+            .stats_callback = &stats_snapshot
     };
     ble_midi_start(&ble_midi_start_args);
+    stats_start();
 
-    uart_start(uart_num, args->rx_pin_num, &uart_queue);
-
-    conn_tick_queue = xQueueCreate(1, sizeof(uint8_t));
-    mtu_change_queue = xQueueCreate(1, sizeof(uint16_t));
-    queue_set = xQueueCreateSet(11);
+    conn_tick_queue = xQueueCreate(CONFIG_BT_NIMBLE_MAX_CONNECTIONS, sizeof(uint8_t));
+    link_change_queue = xQueueCreate(1, sizeof(struct ble_link_t));
+    filter_queue = xQueueCreate(1, sizeof(struct filter_args_t));
+    queue_set = xQueueCreateSet(UART_MIDI_EVENT_QUEUE + 2 + CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
     xQueueAddToSet(conn_tick_queue, queue_set);
     xQueueAddToSet(uart_queue, queue_set);
-    xQueueAddToSet(mtu_change_queue, queue_set);
+    xQueueAddToSet(link_change_queue, queue_set);
+    xQueueAddToSet(filter_queue, queue_set);
 
-    const esp_timer_create_args_t ms_timer_args = {
-            .callback = &ms_timer_callback,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&ms_timer_args, &ms_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(ms_timer, 1000));
-
-    const esp_timer_create_args_t conn_interval_timer_args = {
-            .callback = &conn_interval_timer_callback,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&conn_interval_timer_args, &conn_interval_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(conn_interval_timer, 15000));
+    for (uint8_t slot = 0; slot < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; slot++) {
+        const esp_timer_create_args_t conn_interval_timer_args = {
+                .callback = &conn_interval_timer_callback,
+                .arg = (void *) (uintptr_t) slot,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&conn_interval_timer_args, &conn_timings[slot].timer));
+    }
 
     xTaskCreatePinnedToCore(transmitter_task, "transmitterTask", 4096, (void *) args->uart_num, 1, &uart_task, 1);
 }
 
-void conn_interval_change_callback(uint16_t value) {
-    uint16_t interval_microsec = value * 1250;
-    ESP_LOGE(TAG, "connection interval updated = %dms", interval_microsec / 1000);
+void conn_interval_change_callback(uint8_t slot, uint16_t value) {
+    const uint32_t interval_microsec = value * 1250;
+    ESP_LOGE(TAG, "connection %d interval updated = %" PRIu32 "us", slot, interval_microsec);
 
-    ESP_ERROR_CHECK(esp_timer_stop(conn_interval_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(conn_interval_timer, interval_microsec));
+    taskENTER_CRITICAL(&conn_timing_lock);
+    conn_timings[slot].interval_us = interval_microsec;
+    taskEXIT_CRITICAL(&conn_timing_lock);
+
+    // the timer is running unless this is the connect
+    esp_timer_stop(conn_timings[slot].timer);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(conn_timings[slot].timer, interval_microsec));
+}
+
+void disconnect_callback(uint8_t slot) {
+    esp_timer_stop(conn_timings[slot].timer);
+    receiver_reset(slot);
+}
+
+void link_change_callback(const struct ble_link_t *link) {
+    ESP_LOGE(TAG, "link updated, mtu = %d, ll octets = %d, %s phy, packets of %d bytes", link->mtu, link->ll_octets,
+             link->phy_2m ? "2M" : "1M", ble_link_packet_size(link));
+    // only the latest link matters
+    xQueueOverwrite(link_change_queue, link);
 }
 
-void mtu_change_callback(uint16_t value) {
-    ESP_LOGE(TAG, "mtu updated = %d", value);
-    xQueueGenericSend(mtu_change_queue, &value, 0, queueSEND_TO_BACK);
+void transmitter_set_filter(const struct filter_args_t *filter) {
+    xQueueOverwrite(filter_queue, filter);
 }
 
-static void ms_timer_callback(void *args) {
-    timestamp = esp_timer_get_time() / 1000;
+void transmitter_latency(struct processor_latency_t *latency) {
+    // the histograms are only ever counted up, a copy taken mid-update is at most a message off
+    memcpy(latency, &processor_latency, sizeof(struct processor_latency_t));
+}
+
+uint32_t transmitter_latency_percentile(uint16_t per_mille) {
+    return latency_percentile(&processor_latency.total, per_mille);
 }
 
 static void conn_interval_timer_callback(void *args) {
-    static const uint8_t tick = 1;
-    xQueueGenericSend(conn_tick_queue, &tick, 0, queueSEND_TO_BACK);
+    const uint8_t slot = (uintptr_t) args;
+    xQueueGenericSend(conn_tick_queue, &slot, 0, queueSEND_TO_BACK);
+}
+
+/** The time from the first start bit of a UART_DATA event until the task received it */
+static void measure_ingestion(const uart_event_t *event, int64_t received_us) {
+    const int64_t edge_us = uart_first_edge_us();
+    if (!edge_us) return;
+
+    const uint32_t arrival_us = received_us - edge_us;
+    const uint32_t wire_us = (event->size + (event->timeout_flag ? rx_timeout : 0)) * UART_MIDI_BYTE_US;
+    latency_record(&transmitter_stats.uart_arrival, arrival_us);
+    latency_record(&transmitter_stats.uart_dispatch, arrival_us > wire_us ? arrival_us - wire_us : 0);
+}
+
+/** The next UART_DATA event comes once the message after the last one read is complete */
+static void follow_messages(const struct processor_t *processor) {
+    const uint8_t remaining = processor_message_remaining(processor);
+    const uint8_t threshold = ingestion.rx_full_threshold ? ingestion.rx_full_threshold : UART_MIDI_RX_FULL_THRESHOLD;
+    uart_set_threshold(remaining ? remaining : threshold);
+}
+
+static bool notify_sink(uint8_t *packet, uint16_t len, void *context) {
+    const ble_notify_result result = ble_notify(packet, len);
+    TRACE(TRACE_NOTIFY, result);
+    return result != BLE_NOTIFY_BUSY;
+}
+
+static int64_t processor_clock(void *context) {
+    return time_source_now_us(context);
+}
+
+/** Packets are sized for the link, see ble_link_packet_size, or less when the flush policy closes them earlier */
+static uint16_t packet_size(const struct ble_link_t *link) {
+    const uint16_t buff_max = ble_link_packet_size(link);
+    return flush_policy.fill_threshold && flush_policy.fill_threshold < buff_max ? flush_policy.fill_threshold
+                                                                                 : buff_max;
+}
+
+static void start_processor(struct processor_t *processor, const struct ble_link_t *link) {
+    init_processor(processor, packet_size(link), encoding_mode, notify_sink, NULL);
+    processor->urgent_mask = flush_policy.urgent_mask;
+    processor->coalesce = coalesce;
+    processor->coalesce_watermark = coalesce_watermark;
+    processor->clock = processor_clock;
+    processor->clock_context = time_source;
+    processor->latency = &processor_latency;
+    processor->counters = &transmitter_stats.processor;
+    filter_build(&filter_args, processor->filter);
+}
+
+/** Whether the open packet would be past its deadline if it waited for the connection's next flush tick */
+static bool flush_due(const struct processor_t *processor, uint8_t slot) {
+    if (processor->buff_len == 0) return false;
+    if (flush_policy.deadline_us == 0) return true;
+
+    const uint16_t now = time_source_timestamp(time_source_now_us(time_source));
+    const uint32_t age_us = ((now - processor->packet_open_timestamp) & BLE_MIDI_TIMESTAMP_MASK) * 1000;
+    taskENTER_CRITICAL(&conn_timing_lock);
+    const uint32_t interval_us = conn_timings[slot].interval_us;
+    taskEXIT_CRITICAL(&conn_timing_lock);
+    return age_us + interval_us > flush_policy.deadline_us;
 }
 
 void transmitter_task(void *args) {
-    struct processor_t processor;
-    init_processor(&processor, 514); // max buffer size default_mtu -3 (517 - 3)
+    // every connection starts out at the default ATT MTU, the negotiation right after only ever makes packets larger
+    struct ble_link_t link = BLE_LINK_DEFAULT;
+    start_processor(&processor, &link);
 
     uart_event_t event;
-    uint8_t tick;
-    uint16_t mtu;
+    uint8_t slot;
     QueueSetMemberHandle_t queue_member;
 
+    if (ingestion.message_threshold) follow_messages(&processor);
+    uart_arm_edge();
     for (;;) {
         queue_member = xQueueSelectFromSet(queue_set, portMAX_DELAY);
         if (queue_member == conn_tick_queue) {
-            xQueueReceive(conn_tick_queue, &tick, 0);
-            flush_notify(&processor);
+            xQueueReceive(conn_tick_queue, &slot, 0);
+            TRACE(TRACE_CONN_TICK, slot);
+            // packets the stack pushed back on go first, the open packet keeps filling until they are out
+            if (!ble_notify_retry()) continue;
+            if (flush_due(&processor, slot)) {
+                TRACE(TRACE_FLUSH, processor.buff_len);
+                flush_notify(&processor);
+            } else {
+                TRACE(TRACE_DRAIN, processor.packets_queued);
+                processor_drain(&processor);
+            }
         } else if (queue_member == uart_queue) {
             xQueueReceive(uart_queue, &event, 0);
+            TRACE(TRACE_UART_EVENT, event.type);
+            const int64_t received_us = esp_timer_get_time();
+            int64_t end_us = time_source_now_us(time_source);
 
+            if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) transmitter_stats.uart_overflows++;
             if (event.type != UART_DATA || event.size == 0) continue;
+            transmitter_stats.uart_bytes += event.size;
 
-            uint8_t *ntf;
-            ntf = (uint8_t *) malloc(sizeof(uint8_t) * event.size);
-            memset(ntf, 0x00, event.size);
-            uart_read_bytes(uart_num, ntf, event.size, portMAX_DELAY);
-            for (uint16_t i = 0; i < event.size; i++) {
-                processor.process(ntf[i], timestamp, &processor);
+            // the event fires once the FIFO fills, or after the line went idle for the RX timeout
+            if (event.timeout_flag) end_us -= rx_timeout * UART_MIDI_BYTE_US;
+
+            size_t remaining = event.size;
+            while (remaining > 0) {
+                const int len = uart_read_bytes(uart_num, rx_buff,
+                                                remaining < sizeof(rx_buff) ? remaining : sizeof(rx_buff), 0);
+                if (len <= 0) break;
+                remaining -= len;
+                TRACE(TRACE_UART_READ, len);
+                processor_process_buffer(rx_buff, len, end_us - (int64_t) remaining * UART_MIDI_BYTE_US,
+                                         UART_MIDI_BYTE_US, &processor);
+            }
+            if (ingestion.message_threshold) follow_messages(&processor);
+            if (ingestion.measure_latency) {
+                measure_ingestion(&event, received_us);
+                uart_arm_edge();
             }
-            free(ntf);
-        } else if (queue_member == mtu_change_queue) {
-            xQueueReceive(mtu_change_queue, &mtu, 0);
-            init_processor(&processor, mtu - 3);
+            // packets filled while encoding go out now, the open one waits for the next tick
+            TRACE(TRACE_DRAIN, processor.packets_queued);
+            processor_drain(&processor);
+        } else if (queue_member == link_change_queue) {
+            xQueueReceive(link_change_queue, &link, 0);
+            TRACE(TRACE_MTU, link.mtu);
+            // packets and the message in progress carry over, the first notes after a connect are not lost
+            processor_set_buff_max(&processor, packet_size(&link));
+        } else if (queue_member == filter_queue) {
+            xQueueReceive(filter_queue, &filter_args, 0);
+            filter_build(&filter_args, processor.filter);
         }
     }
     vTaskDelete(NULL);
@@ -1,14 +1,34 @@
+#include "driver/gpio.h"
 #include "driver/uart.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "uart.h"
 
 static uart_port_t uart_int_num;
+static gpio_num_t edge_pin = GPIO_NUM_NC;
+static portMUX_TYPE edge_lock = portMUX_INITIALIZER_UNLOCKED; // 64 bit stores are two, a reader must not see half
+static int64_t first_edge_us;
+
+/** One interrupt per UART_DATA event at most, it disables itself until the transmitter task arms it again */
+static void IRAM_ATTR edge_isr(void *args) {
+    const int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL_ISR(&edge_lock);
+    first_edge_us = now_us;
+    taskEXIT_CRITICAL_ISR(&edge_lock);
+    gpio_intr_disable(edge_pin);
+}
 
-void uart_start(uart_port_t uart_num, int rx_pin_num, QueueHandle_t *queue) {
+void uart_start(uart_port_t uart_num, int rx_pin_num, int tx_pin_num, const struct uart_ingestion_t *ingestion,
+                QueueHandle_t *queue) {
     uart_int_num = uart_num;
     if (!uart_num) uart_num = UART_NUM_0;
     if (!rx_pin_num) rx_pin_num = UART_PIN_NO_CHANGE;
+    if (!tx_pin_num) tx_pin_num = UART_PIN_NO_CHANGE;
 
     uart_config_t uart_config = {
-            .baud_rate = 31250,
+            .baud_rate = UART_MIDI_BAUD_RATE,
             .data_bits = UART_DATA_8_BITS,
             .parity = UART_PARITY_DISABLE,
             .stop_bits = UART_STOP_BITS_1,
@@ -17,6 +37,36 @@ void uart_start(uart_port_t uart_num, int rx_pin_num, QueueHandle_t *queue) {
             .source_clk = UART_SCLK_DEFAULT,
     };
     uart_param_config(uart_num, &uart_config);
-    uart_set_pin(uart_num, UART_PIN_NO_CHANGE, rx_pin_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
-    uart_driver_install(uart_int_num, 4096, 8192, 10, queue, 0);
+    uart_set_pin(uart_num, tx_pin_num, rx_pin_num, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_driver_install(uart_int_num, 4096, 8192, UART_MIDI_EVENT_QUEUE, queue, 0);
+    // the driver sets its defaults on install
+    if (ingestion->rx_timeout) uart_set_rx_timeout(uart_num, ingestion->rx_timeout);
+    if (ingestion->rx_full_threshold) uart_set_rx_full_threshold(uart_num, ingestion->rx_full_threshold);
+
+    if (ingestion->measure_latency && rx_pin_num != UART_PIN_NO_CHANGE) {
+        // the pin stays routed to the UART, the GPIO only watches it
+        edge_pin = rx_pin_num;
+        gpio_set_intr_type(edge_pin, GPIO_INTR_NEGEDGE);
+        gpio_install_isr_service(0);
+        gpio_isr_handler_add(edge_pin, edge_isr, NULL);
+    }
+}
+
+void uart_set_threshold(uint8_t threshold) {
+    uart_set_rx_full_threshold(uart_int_num, threshold);
+}
+
+int64_t uart_first_edge_us(void) {
+    taskENTER_CRITICAL(&edge_lock);
+    const int64_t edge_us = first_edge_us;
+    taskEXIT_CRITICAL(&edge_lock);
+    return edge_us;
+}
+
+void uart_arm_edge(void) {
+    if (edge_pin == GPIO_NUM_NC) return;
+    taskENTER_CRITICAL(&edge_lock);
+    first_edge_us = 0;
+    taskEXIT_CRITICAL(&edge_lock);
+    gpio_intr_enable(edge_pin);
 }
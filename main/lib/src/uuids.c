@@ -8,4 +8,19 @@ const ble_uuid128_t gatt_midi_chr_uuid =
         BLE_UUID128_INIT(0xF3, 0x6B, 0x10, 0x9D, 0x66, 0xF2, 0xA9, 0xA1,
                          0x12, 0x41, 0x68, 0x38, 0xDB, 0xE5, 0x72, 0x77);
 
-const ble_uuid16_t gatt_midi_dsc_uuid = BLE_UUID16_INIT(0x2902);
\ No newline at end of file
+const ble_uuid16_t gatt_midi_dsc_uuid = BLE_UUID16_INIT(0x2902);
+
+// d5da5a88-8dcf-493e-982f-f166d3b5957b
+const ble_uuid128_t gatt_stats_svc_uuid =
+        BLE_UUID128_INIT(0x7B, 0x95, 0xB5, 0xD3, 0x66, 0xF1, 0x2F, 0x98,
+                         0x3E, 0x49, 0xCF, 0x8D, 0x88, 0x5A, 0xDA, 0xD5);
+
+// c04b4bf8-0e7c-4a7e-967f-6023a4ad5ca0
+const ble_uuid128_t gatt_stats_chr_uuid =
+        BLE_UUID128_INIT(0xA0, 0x5C, 0xAD, 0xA4, 0x23, 0x60, 0x7F, 0x96,
+                         0x7E, 0x4A, 0x7C, 0x0E, 0xF8, 0x4B, 0x4B, 0xC0);
+
+// c6429a26-f9d4-4e68-863c-799ff0ddffc8
+const ble_uuid128_t gatt_trace_chr_uuid =
+        BLE_UUID128_INIT(0xC8, 0xFF, 0xDD, 0xF0, 0x9F, 0x79, 0x3C, 0x86,
+                         0x68, 0x4E, 0xD4, 0xF9, 0x26, 0x9A, 0x42, 0xC6);
\ No newline at end of file
@@ -7,7 +7,14 @@ void app_main(void) {
             .conn_interval_max = 0x06, // range 0x06 - 0x0c80
             .preferred_mtu = 500, // max 517
             .uart_num = UART_NUM_0,
-            .rx_pin_num = 1
+            .rx_pin_num = 1,
+            .ingestion = UART_INGESTION_LOW_LATENCY,
+            .playback_delay_us = 10000, // a little over the connection interval
+            .compact_encoding = true,
+            .flush_policy = FLUSH_POLICY_LIVE,
+            .coalesce = PROCESSOR_COALESCE_CONGESTED,
+            .coalesce_watermark = 2, // one packet may wait for the drain after a UART read, two mean congestion
+            .filter = filter_kconfig_args()
     };
     transmitter_start(&args);
 }
\ No newline at end of file